@@ -2,17 +2,18 @@
 #include <avr/pgmspace.h>
 #include <stdint.h>	// int32_t, etc.
 #include <stdbool.h>	// true, false.
-#include <string.h>	// strchr
-#include <stdlib.h>
+#include <string.h>	// memset
 #include "main.h"
-#include "setup.h"
 #include "gps.h"
 
-
 #ifndef GPS_DEBUG
 #define	GPS_DEBUG	0
 #endif
 
+#if (GPS_DEBUG)
+#include "setup.h"	// debug output on the setup channel.
+#endif
+
 #ifndef GPS_IGNORE_FIX
 #define	GPS_IGNORE_FIX	0
 #endif
@@ -22,39 +23,71 @@
 #endif
 
 #define	GPS_MAX_FIELDS	20
+/** Fields this long restart the sentence. */
+#define	GPS_MAX_FIELD_LENGTH	64
 
-/*****************************************************************************/
-typedef struct {
-	uint8_t	hour;			///< 0 .. 23
-	uint8_t	minute;		///< 0 .. 59
-	uint8_t	second;		///< 0 .. 59
-	uint16_t	tick;			///< Internal, set to zero only. 0 .. 7199
-} TIME;
+/** Perfect hash of the 3-letter sentence type (talker ID ignored) into GPS_TYPE_TABLE_SIZE slots.
+ * Collision-free for GGA, ZDA, VTG, RMC, HDT, GSA, GSV and GLL. */
+#define	GPS_TYPE_HASH(a, b, c)	(((a) + ((b) << 1) + ((c) << 2)) & 0x0F)
+#define	GPS_TYPE_TABLE_SIZE	16
+
+
+/** Sentence dispatch table, indexed by GPS_TYPE_HASH. Empty slots have type[0]==0. */
+static const GPS_SENTENCE_DESCRIPTOR	gps_sentence_table[GPS_TYPE_TABLE_SIZE] PROGMEM = {
+#if (GPS_USE_GPZDA)
+	[GPS_TYPE_HASH('G','G','A')] = { { 'G','G','A' }, SENTENCE_GGA, 0, 7, 0, 0, 3 },
+	[GPS_TYPE_HASH('Z','D','A')] = { { 'Z','D','A' }, SENTENCE_ZDA, 2, 0, 0, 3, 0 },
+#else
+	[GPS_TYPE_HASH('G','G','A')] = { { 'G','G','A' }, SENTENCE_GGA, 2, 7, 0, 0, 3 },
+	[GPS_TYPE_HASH('Z','D','A')] = { { 'Z','D','A' }, SENTENCE_ZDA, 0, 0, 0, 0, 0 },
+#endif
+	[GPS_TYPE_HASH('V','T','G')] = { { 'V','T','G' }, SENTENCE_VTG, 0, 0, 2, 0, 0 },
+};
+
+/** Days before the first of each month, non-leap year. */
+static const uint16_t	days_before_month[12] PROGMEM = {
+	0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334,
+};
 
 /*****************************************************************************/
-static uint8_t			gps_field_index = 0;	///< 0 - not receiving, 1=type (GPGGA), 2=time (HHMMSS.s/ss/sss), 3=lat, 4='N'/'S', 5=lon, 6='E'/'W', 7=quality (0=no fix, 1=fix, 2=diff. fix), 8=number of satellites per view, 9=PDOP, 10=altitude, 11=alt. unit, ..., *CHECKSUM
-static uint8_t			gps_buffer[64];	// this 
-static uint8_t			gps_buffer_index = 0;
-static SENTENCE			gps_sentence = SENTENCE_NONE;
-static bool			gps_is_checksum = false;
-static bool			gps_has_fix = false;
-static bool			gps_has_time = false;
-static TIME			gps_time;
-static bool			gps_has_course = false;
-static uint16_t			gps_course_x100 = 0;
-static uint8_t			gps_checksum = 0;
+/** Look up the sentence type from the address field (e.g. GPGGA, GNGGA) into parser->descriptor. */
+static void
+gps_classify(		GPS_PARSER*	parser,
+			const uint8_t	size)
+{
+	if (size==5) {
+		const uint8_t	slot = GPS_TYPE_HASH(parser->type[0], parser->type[1], parser->type[2]);
+		memcpy_P(&parser->descriptor, &gps_sentence_table[slot], sizeof(parser->descriptor));
+		if (parser->descriptor.type[0]==parser->type[0] && parser->descriptor.type[1]==parser->type[1] && parser->descriptor.type[2]==parser->type[2]) {
+			parser->sentence = parser->descriptor.sentence;
+			return;
+		}
+	}
+	memset(&parser->descriptor, 0, sizeof(parser->descriptor));
+}
 
 /*****************************************************************************/
-static uint16_t
-parse_n_decimals(	const uint8_t*	s,
-			const uint8_t	n)
+/** Select the decoder for the given field of the current sentence. */
+static FIELD
+gps_field_of_index(	const GPS_PARSER*	parser,
+			const uint8_t		field_index)
 {
-	uint8_t	i;
-	uint16_t	r = 0;
-	for (i=0; i<n; ++i) {
-		r = r*10 + (s[i]-'0');
+	if (field_index==1) {
+		return FIELD_TYPE;
+	} else if (field_index + 1 >= GPS_MAX_FIELDS) {
+		return FIELD_NONE;
+	} else if (field_index == parser->descriptor.time_field) {
+		return FIELD_TIME;
+	} else if (field_index == parser->descriptor.fix_field) {
+		return FIELD_FIX;
+	} else if (field_index == parser->descriptor.course_field) {
+		return FIELD_COURSE;
+	} else if (parser->descriptor.date_field!=0 && field_index>=parser->descriptor.date_field && field_index<parser->descriptor.date_field+3) {
+		return FIELD_DATE;
+	} else if (parser->descriptor.position_field!=0 && field_index>=parser->descriptor.position_field && field_index<parser->descriptor.position_field+4) {
+		return ((field_index - parser->descriptor.position_field) & 0x01)==0 ? FIELD_COORDINATE : FIELD_HEMISPHERE;
 	}
-	return r;
+	return FIELD_NONE;
 }
 
 /*****************************************************************************/
@@ -65,97 +98,143 @@ hexchar_of_int(		const uint8_t	ii)
 }
 
 /*****************************************************************************/
-static int32_t ticks_of_time(		TIME*				t)
+/** Time since 2000-01-01, or since midnight when the sentence has no date. */
+static void
+epoch_of_time(
+	EPOCH_TIME*	r,
+	const TIME*	t,
+	const bool	has_date)
 {
-	// hour
-	int32_t	r = t->hour;
+	// hour, minute, second
+	uint32_t	seconds = t->hour;
+	seconds = seconds*60 + t->minute;
+	seconds = seconds*60 + t->second;
 
-	// minute
-	r *= 60;
-	r += t->minute;
+	// days
+	if (has_date) {
+		const uint8_t	years = t->year - 2000;
+		uint16_t	days = years*365u + (years+3)/4 + pgm_read_word(&days_before_month[t->month-1]) + t->day - 1;
+		if ((years & 0x03)==0 && t->month>2) {
+			++days;
+		}
+		seconds += days * 86400UL;
+	}
 
-	// second
-	r *= 60;
-	r += t->second;
+	r->seconds = seconds;
+	r->ticks = t->tick;
+}
 
-	// ticks
-	r *= PRECISION_TICKS_PER_SECOND;
-	r += t->tick;
-	return r;
+/*****************************************************************************/
+/** Fold character at position \c pos of HHMMSS.ss into parser->time. */
+static void
+gps_time_put(
+	GPS_PARSER*	parser,
+	const uint8_t	pos,
+	const uint8_t	c)
+{
+	TIME*		t = &parser->time;
+
+	switch (pos) {
+	case 0: /* fallthrough */
+	case 1:
+		t->hour = t->hour*10 + (c-'0');
+		break;
+	case 2: /* fallthrough */
+	case 3:
+		t->minute = t->minute*10 + (c-'0');
+		break;
+	case 4: /* fallthrough */
+	case 5:
+		t->second = t->second*10 + (c-'0');
+		break;
+	case 6:
+		parser->time_has_dot = c=='.';
+		break;
+	case 7: /* fallthrough */
+	case 8: /* fallthrough */
+	case 9:
+		t->tick = t->tick*10 + (c-'0');
+		break;
+	}
 }
 
 /*****************************************************************************/
+/** Scale the fractional seconds once the whole field of \c size characters is in. */
 static bool
-gps_parse_time(
-	TIME*		t,
-	const uint8_t*	s,
+gps_time_finish(
+	GPS_PARSER*	parser,
 	const uint8_t	size)
 {
-	uint16_t		ticks = 0;
+	TIME*		t = &parser->time;
 
 	if (size<6) {
 		return false;
 	}
 
-	if (size>=8 && s[6]=='.') {
-		const uint8_t	dotpos = 6;
-		const uint8_t	n = size - 6 - 1;
-		switch (n) {
+	if (size>=8 && parser->time_has_dot) {
+		switch (size - 6 - 1) {
 		case 1:
-			ticks = parse_n_decimals(s + dotpos + 1, n);
-			ticks = ticks * (PRECISION_TICKS_PER_SECOND / 10);
+			t->tick = t->tick * (PRECISION_TICKS_PER_SECOND / 10);
 			break;
 		case 2:
-			ticks = parse_n_decimals(s + dotpos + 1, n);
-			ticks = ticks * (PRECISION_TICKS_PER_SECOND / 100);
+			t->tick = t->tick * (PRECISION_TICKS_PER_SECOND / 100);
 			break;
 		case 3:
-			ticks = parse_n_decimals(s + dotpos + 1, n);
-			ticks = (ticks / 5) * (PRECISION_TICKS_PER_SECOND / 200);
+			t->tick = (t->tick / 5) * (PRECISION_TICKS_PER_SECOND / 200);
 			break;
 		default:
 			return false;
 		}
+	} else {
+		t->tick = 0;
 	}
 
-	t->hour   = parse_n_decimals(s  , 2);
-	t->minute = parse_n_decimals(s+2, 2);
-	t->second = parse_n_decimals(s+4, 2);
-	t->tick		= ticks;
-
 	return true;
 }
 
+/*****************************************************************************/
+/** Fold character at position \c pos of a decimal number into \c d. */
+static void
+gps_decimal_put(
+	DECIMAL*	d,
+	const uint8_t	pos,
+	const uint8_t	c)
+{
+	if (d->dot_position < 0) {
+		if (c == '.') {
+			d->dot_position = pos;
+		} else if (c>='0' && c<='9' && !d->integer_done) {
+			d->integer = d->integer*10 + (c-'0');
+		} else {
+			d->integer_done = true;
+		}
+	} else if (pos - d->dot_position <= 5) {
+		d->fraction = d->fraction*10 + (c-'0');
+	}
+}
+
 /*****************************************************************************/
 static bool
-gps_parse_course(
+gps_course_finish(
 	uint16_t*	course_x100,
-	const char*	s,
+	const DECIMAL*	d,
 	const uint8_t	size)
 {
-	const char*	dotptr = strchr(s, '.');
-	const int8_t	dotpos = dotptr==0
-				? -1
-				: (dotptr - s);
-	uint16_t	before_comma = atoi(s);
-	
-	if (*s) {
-		if (dotpos > 0) {
-			const int8_t	n = size - dotpos - 1;
-			const uint16_t	after_comma = parse_n_decimals((const uint8_t*)(s + dotpos + 1), n);
-			switch (n) {
+	if (size>0) {
+		if (d->dot_position > 0) {
+			switch (size - d->dot_position - 1) {
 			case 1:
-				*course_x100 = before_comma*100 + after_comma*10;
+				*course_x100 = d->integer*100 + d->fraction*10;
 				return true;
 			case 2:
-				*course_x100 = before_comma*100 + after_comma;
+				*course_x100 = d->integer*100 + d->fraction;
 				return true;
 			case 3:
-				*course_x100 = before_comma*100 + after_comma/10;
+				*course_x100 = d->integer*100 + d->fraction/10;
 				return true;
 			}
 		} else {
-			*course_x100 = before_comma * 100;
+			*course_x100 = d->integer * 100;
 			return true;
 		}
 	}
@@ -164,167 +243,312 @@ gps_parse_course(
 }
 
 /*****************************************************************************/
-SENTENCE
-handle_gps_input(	const uint8_t		c,
-			int32_t*		out_time,
-			uint16_t*		course_x100)
+/** Latitude DDMM.mmmmm or longitude DDDMM.mmmmm into 0.00001 arcminutes. */
+static bool
+gps_coordinate_finish(
+	int32_t*	coordinate,
+	const DECIMAL*	d,
+	const uint8_t	size)
+{
+	uint32_t	fraction = d->fraction;
+	uint8_t		digits = 0;
+
+	if (size==0 || d->dot_position==0 || d->integer_done || d->integer % 100 >= 60) {
+		return false;
+	}
+	if (d->dot_position > 0) {
+		digits = size - d->dot_position - 1;
+	}
+	for (; digits<5; ++digits) {
+		fraction = fraction * 10;
+	}
+
+	*coordinate = ((int32_t)(d->integer / 100)*60 + d->integer % 100) * 100000L + fraction;
+	return true;
+}
+
+/*****************************************************************************/
+/** Prepare the decoders for a new field. */
+static void
+gps_start_field(	GPS_PARSER*	parser,
+			const uint8_t	field_index)
 {
-	SENTENCE	r = SENTENCE_NONE;
-
-	switch (c) {
-	case '$':
-		// Start again.
-		gps_field_index = 1;
-		gps_buffer_index = 0;
-		gps_sentence = SENTENCE_NONE;
-		gps_is_checksum = false;
-		gps_has_fix = false;
-		gps_has_time = false;
-		gps_has_course = false;
-		gps_checksum = 0;
-		gps_buffer[0] = 0;
+	parser->field = gps_field_of_index(parser, field_index);
+	parser->field_length = 0;
+	switch (parser->field) {
+	case FIELD_TIME:
+		memset(&parser->time, 0, sizeof(parser->time));
+		parser->time_has_dot = false;
 		break;
-	case '*':
-		// Switch to checksum.
-		gps_is_checksum = true;
-		gps_buffer_index = 0;
-		gps_buffer[0] = 0;
+	case FIELD_DATE:
+		parser->date_value = 0;
 		break;
-	case ',':
-		gps_checksum = gps_checksum ^ c;
-		// Field over.
-		if (gps_field_index>=1 && gps_field_index + 1 < GPS_MAX_FIELDS) {
-			if (gps_field_index==1) {
-				if (gps_buffer_index==5) {
-					if (memcmp_P(gps_buffer, PSTR("GPGGA"), 5)==0) {
-						gps_sentence = SENTENCE_GGA;
-					} else if (memcmp_P(gps_buffer, PSTR("GPZDA"), 5)==0) {
-						gps_sentence = SENTENCE_ZDA;
-					} else if (memcmp_P(gps_buffer, PSTR("GPVTG"), 5)==0) {
-						gps_sentence = SENTENCE_VTG;
-					}
-				}
-			} else if (gps_sentence == SENTENCE_GGA) {
-#if (!GPS_USE_GPZDA)
-				switch (gps_field_index) {
-					case 2:
-						// time
-						gps_has_time = gps_parse_time(&gps_time, gps_buffer, gps_buffer_index);
-						break;
-					case 7:
-						// fix
-						gps_has_fix = gps_buffer_index>0 && gps_buffer[0]!='0';
-#if (GPS_DEBUG)
-						if (gps_has_fix) {
-							setup_send_P(PSTR("GOT FIX\r\n"));
-						} else {
-							setup_send_char('$');
-							setup_send_hex(gps_buffer_index);
-							setup_send_char('_');
-							setup_send_hex(gps_buffer[0]);
-							setup_send_P(PSTR("NO FIX\r\n"));
-						}
-						break;
-#endif
-#if (GPS_IGNORE_FIX)
-						gps_has_fix = true;
-#endif
-				}
-#endif
-			} else if (gps_sentence == SENTENCE_ZDA) {
-#if (GPS_USE_GPZDA)
-				if (gps_field_index == 2) {
-					gps_has_time = gps_parse_time(&gps_time, gps_buffer, gps_buffer_index);
-					gps_has_fix = gps_has_time;
-				}
-#endif
-			} else if (gps_sentence == SENTENCE_VTG) {
-				if (gps_field_index == 2) {
-					gps_has_course = gps_parse_course(&gps_course_x100, (const char*)gps_buffer, gps_buffer_index);
-#if (0)
-					setup_send_P(PSTR("\r\nbuffer="));
-					setup_send(gps_buffer);
-					setup_send_P(PSTR("\r\n"));
-					setup_send_integer(PSTR("gps_course_x100"), gps_course_x100, PSTR(""));
-#endif
-				}
-			}
-		}
-		gps_buffer_index = 0;
-		gps_buffer[0] = 0;
-		++gps_field_index;
+	case FIELD_COURSE:
+		parser->course.integer = 0;
+		parser->course.fraction = 0;
+		parser->course.dot_position = -1;
+		parser->course.integer_done = false;
+		break;
+	case FIELD_COORDINATE:
+		parser->coordinate.integer = 0;
+		parser->coordinate.fraction = 0;
+		parser->coordinate.dot_position = -1;
+		parser->coordinate.integer_done = false;
 		break;
-	case 0x0D:
-		// Check checksum.
-		if (gps_buffer_index>=2 && hexchar_of_int(gps_checksum >> 4)==gps_buffer[0] && hexchar_of_int(gps_checksum & 0x0F)==gps_buffer[1]) {
-			switch (gps_sentence) {
-				case SENTENCE_GGA: /* fallthrough */
-				case SENTENCE_ZDA:
-					if (gps_has_time && gps_has_fix) {
-						// YES!
-						*out_time = ticks_of_time(&gps_time);
-						r = gps_sentence;
+	default:
+		break;
+	}
+}
+
+/*****************************************************************************/
+uint16_t
+handle_gps_span(	GPS_PARSER*		parser,
+			const uint8_t*		data,
+			const uint16_t		size,
+			SENTENCE*		sentence,
+			GPS_DATA*		result)
+{
+	uint16_t	i = 0;
+
+	*sentence = SENTENCE_NONE;
+	while (i<size) {
+		const uint8_t	c = data[i++];
+		switch (c) {
+		case '$':
+			// Start again.
+			parser->field_index = 1;
+			parser->sentence = SENTENCE_NONE;
+			parser->is_checksum = false;
+			parser->has_fix = false;
+			parser->has_position_fix = false;
+			parser->has_time = false;
+			parser->has_course = false;
+			parser->has_date = false;
+			parser->has_latitude = false;
+			parser->has_longitude = false;
+			parser->checksum = 0;
+			gps_start_field(parser, parser->field_index);
+			return i;
+		case '*':
+			// Switch to checksum.
+			parser->is_checksum = true;
+			parser->field_length = 0;
+			break;
+		case ',':
+			parser->checksum = parser->checksum ^ c;
+			// Field over.
+			if (parser->field_index>=1 && !parser->is_checksum) {
+				switch (parser->field) {
+				case FIELD_TYPE:
+					gps_classify(parser, parser->field_length);
+					break;
+				case FIELD_TIME:
+					parser->has_time = gps_time_finish(parser, parser->field_length);
+					if (parser->descriptor.fix_field == 0) {
+						parser->has_fix = parser->has_time;
+					}
+					break;
+				case FIELD_FIX:
+					parser->has_fix = parser->field_length>0 && parser->first_char!='0';
+					parser->has_position_fix = parser->has_fix;
 #if (GPS_DEBUG)
-						setup_send_P(PSTR("TIME OK\r\n"));
-#endif
+					if (parser->has_fix) {
+						setup_send_P(PSTR("GOT FIX\r\n"));
 					} else {
-#if (GPS_DEBUG)
-						if (gps_has_time) {
-							setup_send_P(PSTR("FIX MISSING\r\n"));
-						} else {
-							setup_send_P(PSTR("CK OK\r\n"));
-						}
+						setup_send_char('$');
+						setup_send_hex(parser->field_length);
+						setup_send_char('_');
+						setup_send_hex(parser->first_char);
+						setup_send_P(PSTR("NO FIX\r\n"));
+					}
+#elif (GPS_IGNORE_FIX)
+					parser->has_fix = true;
 #endif
+					break;
+				case FIELD_COURSE:
+					parser->has_course = gps_course_finish(&parser->course_x100, &parser->course, parser->field_length);
+					break;
+				case FIELD_DATE:
+					switch (parser->field_index - parser->descriptor.date_field) {
+					case 0:
+						parser->time.day = parser->date_value;
+						break;
+					case 1:
+						parser->time.month = parser->date_value;
+						break;
+					default:
+						parser->time.year = parser->date_value;
+						parser->has_date = parser->time.day>=1 && parser->time.day<=31
+							&& parser->time.month>=1 && parser->time.month<=12
+							&& parser->time.year>=2000 && parser->time.year<=2099;
+						break;
+					}
+					break;
+				case FIELD_COORDINATE:
+					if (parser->field_index == parser->descriptor.position_field) {
+						parser->has_latitude = gps_coordinate_finish(&parser->latitude, &parser->coordinate, parser->field_length);
+					} else {
+						parser->has_longitude = gps_coordinate_finish(&parser->longitude, &parser->coordinate, parser->field_length);
 					}
 					break;
-				case SENTENCE_VTG:
-					if (gps_has_course) {
-						*course_x100 = gps_course_x100;
-						r = gps_sentence;
+				case FIELD_HEMISPHERE:
+					if (parser->field_index == parser->descriptor.position_field + 1) {
+						if (parser->field_length>0 && parser->first_char=='S') {
+							parser->latitude = -parser->latitude;
+						} else if (parser->field_length==0 || parser->first_char!='N') {
+							parser->has_latitude = false;
+						}
+					} else {
+						if (parser->field_length>0 && parser->first_char=='W') {
+							parser->longitude = -parser->longitude;
+						} else if (parser->field_length==0 || parser->first_char!='E') {
+							parser->has_longitude = false;
+						}
 					}
 					break;
 				default:
-					break; // pass
+					break;
+				}
 			}
-		} else {
+			++parser->field_index;
+			gps_start_field(parser, parser->field_index);
+			break;
+		case 0x0D:
+			// Check checksum. Sentences without one are rejected, checksum_chars are from an older sentence.
+			if (parser->is_checksum && parser->field_length>=2 && hexchar_of_int(parser->checksum >> 4)==parser->checksum_chars[0] && hexchar_of_int(parser->checksum & 0x0F)==parser->checksum_chars[1]) {
+				++stats.sentences[parser->sentence];
+				result->has_time = false;
+				result->has_course = false;
+				result->has_position = false;
+				switch (parser->sentence) {
+					case SENTENCE_GGA: /* fallthrough */
+					case SENTENCE_ZDA:
+						if (parser->has_position_fix && parser->has_latitude && parser->has_longitude) {
+							result->has_position = true;
+							result->latitude = parser->latitude;
+							result->longitude = parser->longitude;
+							*sentence = parser->sentence;
+						}
+						if (parser->has_time && parser->has_fix && (parser->descriptor.date_field==0 || parser->has_date)) {
+							// YES!
+							result->has_time = true;
+							epoch_of_time(&result->time, &parser->time, parser->has_date);
+							*sentence = parser->sentence;
 #if (GPS_DEBUG)
-			setup_send_char(gps_has_time ? '!' : '#');
-			setup_send_hex(gps_sentence);
-			setup_send_char(':');
-			setup_send_hex(gps_checksum);
-			setup_send_char('=');
-			setup_send_char(gps_buffer[0]);
-			setup_send_char(gps_buffer[1]);
-			setup_send_P(PSTR("\r\n"));
+							setup_send_P(PSTR("TIME OK\r\n"));
 #endif
-		}
-		// Clear.
-		gps_field_index = 0;
-		gps_has_time = false;
-		gps_has_fix = false;
-		gps_has_course = false;
-		gps_sentence = SENTENCE_NONE;
-		break;
-	case 0x0A:
-		// pass.
-		break;
-	default:
-		// Receiving?
-		if (gps_field_index>0) {
-			// !Overflow?
-			if (gps_buffer_index+1 < sizeof(gps_buffer)/sizeof(gps_buffer[0])) {
-				gps_buffer[gps_buffer_index] = c;
-				++gps_buffer_index;
-				gps_buffer[gps_buffer_index] = 0;	// prepare with zeros :)
-				if (!gps_is_checksum) {
-					gps_checksum ^= c;
+						} else {
+#if (GPS_DEBUG)
+							if (parser->has_time) {
+								setup_send_P(PSTR("FIX MISSING\r\n"));
+							} else {
+								setup_send_P(PSTR("CK OK\r\n"));
+							}
+#endif
+						}
+						break;
+					case SENTENCE_VTG:
+						if (parser->has_course) {
+							result->has_course = true;
+							result->course_x100 = parser->course_x100;
+							*sentence = parser->sentence;
+						}
+						break;
+					default:
+						break; // pass
 				}
 			} else {
-				gps_field_index = 0; // restart on overflow.
+				if (parser->field_index > 0) {
+					++stats.checksum_errors;
+				}
+#if (GPS_DEBUG)
+				setup_send_char(parser->has_time ? '!' : '#');
+				setup_send_hex(parser->sentence);
+				setup_send_char(':');
+				setup_send_hex(parser->checksum);
+				setup_send_char('=');
+				setup_send_char(parser->checksum_chars[0]);
+				setup_send_char(parser->checksum_chars[1]);
+				setup_send_P(PSTR("\r\n"));
+#endif
+			}
+			// Clear.
+			parser->field_index = 0;
+			parser->has_time = false;
+			parser->has_fix = false;
+			parser->has_position_fix = false;
+			parser->has_course = false;
+			parser->has_date = false;
+			parser->has_latitude = false;
+			parser->has_longitude = false;
+			parser->sentence = SENTENCE_NONE;
+			return i;
+		case 0x0A:
+			return i;
+		default:
+			// Receiving?
+			if (parser->field_index>0) {
+				// !Overflow?
+				if (parser->field_length+1 < GPS_MAX_FIELD_LENGTH) {
+					if (parser->is_checksum) {
+						if (parser->field_length < 2) {
+							parser->checksum_chars[parser->field_length] = c;
+						}
+					} else {
+						parser->checksum ^= c;
+						switch (parser->field) {
+						case FIELD_TYPE:
+							if (parser->field_length>=2 && parser->field_length<5) {
+								parser->type[parser->field_length - 2] = c;
+							}
+							break;
+						case FIELD_TIME:
+							gps_time_put(parser, parser->field_length, c);
+							break;
+						case FIELD_FIX: /* fallthrough */
+						case FIELD_HEMISPHERE:
+							if (parser->field_length == 0) {
+								parser->first_char = c;
+							}
+							break;
+						case FIELD_COURSE:
+							gps_decimal_put(&parser->course, parser->field_length, c);
+							break;
+						case FIELD_COORDINATE:
+							gps_decimal_put(&parser->coordinate, parser->field_length, c);
+							break;
+						case FIELD_DATE:
+							if (c>='0' && c<='9' && parser->date_value<1000) {
+								parser->date_value = parser->date_value*10 + (c-'0');
+							} else {
+								parser->date_value = 0xFFFF;
+							}
+							break;
+						default:
+							break;
+						}
+					}
+					++parser->field_length;
+				} else {
+					parser->field_index = 0; // restart on overflow.
+					++stats.parser_restarts;
+				}
 			}
 		}
+
 	}
 
+	return i;
+}
+
+/*****************************************************************************/
+SENTENCE
+handle_gps_input(	GPS_PARSER*		parser,
+			const uint8_t		c,
+			GPS_DATA*		result)
+{
+	SENTENCE	r;
+	handle_gps_span(parser, &c, 1, &r, result);
 	return r;
 }
 
@@ -5,6 +5,7 @@
 
 #include <stdint.h>	// int32_t, etc.
 #include <stdbool.h>	// true, false.
+#include "main.h"	// EPOCH_TIME
 
 
 typedef enum {
@@ -14,11 +15,108 @@ typedef enum {
 	SENTENCE_ZDA = 3,
 } SENTENCE;
 
+/*****************************************************************************/
+typedef struct {
+	uint8_t	hour;			///< 0 .. 23
+	uint8_t	minute;		///< 0 .. 59
+	uint8_t	second;		///< 0 .. 59
+	uint16_t	tick;			///< Internal, set to zero only. 0 .. 7199
+	uint8_t	day;			///< 1 .. 31
+	uint8_t	month;		///< 1 .. 12
+	uint16_t	year;			///< 2000 .. 2099
+} TIME;
+
+/*****************************************************************************/
+/** What to do with a given sentence type. Field indices are 0 when not used. */
+typedef struct {
+	char		type[3];			///< Sentence type without the talker ID, e.g. "GGA".
+	uint8_t	sentence;			///< SENTENCE
+	uint8_t	time_field;		///< HHMMSS.ss
+	uint8_t	fix_field;		///< Fix quality, '0' = no fix.
+	uint8_t	course_field;	///< Course over ground, degrees.
+	uint8_t	date_field;		///< Day, followed by month and year.
+	uint8_t	position_field;	///< Latitude, followed by N/S, longitude and E/W.
+} GPS_SENTENCE_DESCRIPTOR;
+
+/*****************************************************************************/
+/** How the characters of the current field are decoded. */
+typedef enum {
+	FIELD_NONE = 0,		///< Ignored.
+	FIELD_TYPE,				///< Address field, e.g. GPGGA.
+	FIELD_TIME,				///< HHMMSS.s/ss/sss
+	FIELD_FIX,				///< Fix quality.
+	FIELD_COURSE,			///< Course, ddd.d/dd/ddd
+	FIELD_DATE,				///< Day, month or year, decimal integer.
+	FIELD_COORDINATE,	///< Latitude DDMM.mmmmm or longitude DDDMM.mmmmm
+	FIELD_HEMISPHERE,	///< 'N'/'S' or 'E'/'W'.
+} FIELD;
+
+/*****************************************************************************/
+/** Decimal number decoded one character at a time. */
+typedef struct {
+	uint16_t	integer;					///< Digits before the dot, up to the first non-digit.
+	uint32_t	fraction;					///< First 5 characters after the dot.
+	int8_t	dot_position;			///< -1 when no dot seen yet.
+	bool		integer_done;			///< Non-digit seen before the dot.
+} DECIMAL;
+
+/*****************************************************************************/
+/** State of one NMEA stream. Zero-initialized state is valid. */
+typedef struct {
+	uint8_t			field_index;	///< 0 - not receiving, 1=type (GPGGA), 2=time (HHMMSS.s/ss/sss), 3=lat, 4='N'/'S', 5=lon, 6='E'/'W', 7=quality (0=no fix, 1=fix, 2=diff. fix), 8=number of satellites per view, 9=PDOP, 10=altitude, 11=alt. unit, ..., *CHECKSUM
+	uint8_t			field_length;	///< Number of characters received in the current field.
+	FIELD			field;		///< Decoder of the current field.
+	uint8_t			type[3];	///< Characters 2..4 of the address field.
+	uint8_t			first_char;	///< First character of the current field.
+	uint8_t			checksum_chars[2];	///< Received checksum, hex.
+	SENTENCE		sentence;
+	GPS_SENTENCE_DESCRIPTOR	descriptor;	///< Copy of the sentence table entry of the current sentence.
+	bool			is_checksum;
+	bool			has_fix;
+	bool			has_position_fix;	///< Fix quality seen, regardless of GPS_IGNORE_FIX.
+	bool			has_time;
+	TIME			time;
+	bool			time_has_dot;
+	bool			has_date;
+	uint16_t		date_value;	///< Digits of the current date field, 0xFFFF when invalid.
+	bool			has_course;
+	DECIMAL			course;
+	uint16_t		course_x100;
+	DECIMAL			coordinate;	///< Current latitude or longitude field.
+	bool			has_latitude;
+	int32_t			latitude;
+	bool			has_longitude;
+	int32_t			longitude;
+	uint8_t			checksum;
+} GPS_PARSER;
+
+/*****************************************************************************/
+/** Values of a completed sentence. */
+typedef struct {
+	bool			has_time;	///< ZDA, or GGA when GPS_USE_GPZDA is off.
+	EPOCH_TIME		time;		///< Dated for ZDA. GGA has no date, its seconds count from midnight.
+	bool			has_course;	///< VTG
+	uint16_t		course_x100;	///< 0 .. 35999
+	bool			has_position;	///< GGA with a fix.
+	int32_t			latitude;	///< 0.00001 arcminutes, north positive.
+	int32_t			longitude;	///< 0.00001 arcminutes, east positive.
+} GPS_DATA;
+
+/** Handle gps input, stopping after each '$', 0x0D and 0x0A.
+ * Returns the number of bytes consumed, the completed sentence (if any) is stored in *sentence
+ * and its values in *result. */
+extern uint16_t
+handle_gps_span(	GPS_PARSER*		parser,
+			const uint8_t*		data,
+			const uint16_t		size,
+			SENTENCE*		sentence,
+			GPS_DATA*		result);
+
 /** Handle gps input. */
 extern SENTENCE
-handle_gps_input(	const uint8_t		c,
-			int32_t*		gps_time,
-			uint16_t*		course_x100);
+handle_gps_input(	GPS_PARSER*		parser,
+			const uint8_t		c,
+			GPS_DATA*		result);
 
 
 #endif /* gps_h_ */
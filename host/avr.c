@@ -0,0 +1,24 @@
+// vim: ts=4 shiftwidth=4
+/** Registers and EEPROM of the host stand-ins <avr/io.h> and <avr/eeprom.h>. */
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#define	AVR_DEFINE8(name)	volatile uint8_t name;
+#define	AVR_DEFINE16(name)	volatile uint16_t name;
+AVR_REGISTERS(AVR_DEFINE8, AVR_DEFINE16)
+
+static volatile uint16_t	tcnt1;
+uint16_t					(*avr_tcnt1_hook)(void) = 0;
+
+/** TCNT1, see avr_tcnt1_hook. */
+volatile uint16_t*
+avr_tcnt1(void)
+{
+	if (avr_tcnt1_hook != 0) {
+		tcnt1 = avr_tcnt1_hook();
+	}
+	return &tcnt1;
+}
+
+/** Erased, as a new part. */
+uint8_t		avr_eeprom[AVR_EEPROM_SIZE] = { [0 ... AVR_EEPROM_SIZE-1] = 0xFF };
@@ -0,0 +1,48 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_avr_eeprom_h_
+#define host_avr_eeprom_h_
+
+/** Host stand-in for avr-libc <avr/eeprom.h>: the 4 KiB EEPROM is avr_eeprom, defined in host/avr.c.
+ * Addresses are EEPROM offsets cast to pointers, as on the AVR. Erased cells read 0xFF. */
+
+#include <stddef.h>	// size_t
+#include <stdint.h>	// uint8_t, uintptr_t
+#include <string.h>	// memcpy
+
+#define	AVR_EEPROM_SIZE		4096
+
+extern uint8_t	avr_eeprom[AVR_EEPROM_SIZE];
+
+static inline uint8_t
+eeprom_read_byte(		const uint8_t*	address)
+{
+	return avr_eeprom[(uintptr_t)address];
+}
+
+static inline void
+eeprom_write_byte(		uint8_t*		address,
+						const uint8_t	value)
+{
+	avr_eeprom[(uintptr_t)address] = value;
+}
+
+static inline void
+eeprom_read_block(		void*			data,
+						const void*		address,
+						const size_t	size)
+{
+	memcpy(data, avr_eeprom + (uintptr_t)address, size);
+}
+
+static inline void
+eeprom_write_block(		const void*		data,
+						void*			address,
+						const size_t	size)
+{
+	memcpy(avr_eeprom + (uintptr_t)address, data, size);
+}
+
+#define	eeprom_update_byte	eeprom_write_byte
+#define	eeprom_update_block	eeprom_write_block
+
+#endif /* host_avr_eeprom_h_ */
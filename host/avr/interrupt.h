@@ -0,0 +1,14 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_avr_interrupt_h_
+#define host_avr_interrupt_h_
+
+/** Host stand-in for avr-libc <avr/interrupt.h>. An ISR is a plain function the harness calls,
+ * cli and sei only move the I bit of SREG. */
+
+#include <avr/io.h>
+
+#define	ISR(vector)	void vector(void); void vector(void)
+#define	cli()		(SREG &= ~0x80)
+#define	sei()		(SREG |= 0x80)
+
+#endif /* host_avr_interrupt_h_ */
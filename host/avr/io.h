@@ -0,0 +1,78 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_avr_io_h_
+#define host_avr_io_h_
+
+/** Host stand-in for avr-libc <avr/io.h>: the atmega1280 registers the firmware uses, as plain
+ * variables defined in host/avr.c. Nothing happens on a write, harnesses model the peripherals.
+ * TCNT1 goes through avr_tcnt1_hook when a harness sets one, so the count can run while the code does. */
+
+#include <stdint.h>	// uint8_t, etc.
+
+#define	_BV(bit)	(1 << (bit))
+
+#define	AVR_UART_REGISTERS(R8, R16, n) \
+	R16(UBRR##n) R8(UCSR##n##A) R8(UCSR##n##B) R8(UCSR##n##C) R8(UDR##n)
+
+/** Every register, for AVR_REGISTERS(declare 8-bit, declare 16-bit). */
+#define	AVR_REGISTERS(R8, R16) \
+	R8(SREG) \
+	R8(PORTA) R8(DDRA) R8(PORTB) R8(DDRB) R8(PORTC) R8(DDRC) R8(PORTD) R8(DDRD) \
+	R8(PORTE) R8(DDRE) R8(PORTF) R8(DDRF) R8(PORTG) R8(DDRG) R8(PORTH) R8(DDRH) \
+	R8(PORTJ) R8(DDRJ) R8(PORTK) R8(DDRK) R8(PORTL) R8(DDRL) \
+	R8(TCCR1A) R8(TCCR1B) R8(TCCR1C) R16(OCR1A) R16(OCR1B) R16(OCR1C) R8(TIMSK1) R8(TIFR1) \
+	R8(TCCR3A) R8(TCCR3B) R8(TCCR3C) R16(TCNT3) R8(TIMSK3) R8(TIFR3) \
+	AVR_UART_REGISTERS(R8, R16, 0) AVR_UART_REGISTERS(R8, R16, 1) \
+	AVR_UART_REGISTERS(R8, R16, 2) AVR_UART_REGISTERS(R8, R16, 3)
+
+#define	AVR_DECLARE8(name)	extern volatile uint8_t name;
+#define	AVR_DECLARE16(name)	extern volatile uint16_t name;
+AVR_REGISTERS(AVR_DECLARE8, AVR_DECLARE16)
+
+/** Called on every access to TCNT1, returns the count. NULL: TCNT1 keeps what was written. */
+extern uint16_t		(*avr_tcnt1_hook)(void);
+volatile uint16_t*	avr_tcnt1(void);
+#define	TCNT1		(*avr_tcnt1())
+
+#define	PB6			6
+#define	PB7			7
+
+/** Timer1 */
+#define	CS10		0
+#define	CS11		1
+#define	CS12		2
+#define	COM1C0		2
+#define	COM1C1		3
+#define	COM1B0		4
+#define	COM1B1		5
+#define	COM1A0		6
+#define	COM1A1		7
+#define	FOC1C		5
+#define	FOC1B		6
+#define	FOC1A		7
+#define	TOIE1		0
+#define	OCIE1A		1
+#define	OCIE1B		2
+#define	OCIE1C		3
+#define	TOV1		0
+#define	OCF1A		1
+#define	OCF1B		2
+#define	OCF1C		3
+
+/** Timer3 */
+#define	CS30		0
+#define	TOIE3		0
+#define	TOV3		0
+
+/** USARTn, the same bits on every port. */
+#define	AVR_UART_BITS(n) \
+	enum { \
+		UPE##n = 2, DOR##n = 3, FE##n = 4, \
+		UCSZ##n##0 = 1, UCSZ##n##1 = 2, \
+		TXEN##n = 3, RXEN##n = 4, UDRIE##n = 5, TXCIE##n = 6, RXCIE##n = 7, \
+	};
+AVR_UART_BITS(0)
+AVR_UART_BITS(1)
+AVR_UART_BITS(2)
+AVR_UART_BITS(3)
+
+#endif /* host_avr_io_h_ */
@@ -0,0 +1,26 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_avr_pgmspace_h_
+#define host_avr_pgmspace_h_
+
+/** Host stand-in for avr-libc <avr/pgmspace.h>: flash is ordinary memory. */
+
+#include <stdint.h>	// uint8_t, etc.
+#include <stdio.h>	// sprintf
+#include <string.h>	// memcmp, memcpy, strlen
+
+#define	PROGMEM
+#define	PGM_P				const char*
+#define	PSTR(s)				(s)
+
+#define	pgm_read_byte(p)	(*(const uint8_t*)(p))
+#define	pgm_read_word(p)	(*(const uint16_t*)(p))
+
+#define	memcmp_P			memcmp
+#define	memcpy_P			memcpy
+#define	strlen_P			strlen
+#define	strcpy_P			strcpy
+#define	strncpy_P			strncpy
+#define	sprintf_P			sprintf
+#define	snprintf_P			snprintf
+
+#endif /* host_avr_pgmspace_h_ */
@@ -0,0 +1,2 @@
+// vim: ts=4 shiftwidth=4
+/** Host stand-in for avr-libc <avr/wdt.h>, nothing used. */
@@ -0,0 +1,114 @@
+// vim: ts=4 shiftwidth=4
+/** Cost of classifying the NMEA address field on the host: the hashed descriptor table in gps.c
+ * against the memcmp_P chain it replaced, over a mix of talkers and sentence types.
+ *
+ *	host/build/bench_classify
+ */
+#include <stdint.h>	// uint8_t, etc.
+#include <stdio.h>	// printf
+#include <time.h>	// clock_gettime
+#include "../gps.c"	// gps_classify is static.
+
+/** gps.c counts sentences here, main.c defines it on the AVR. */
+STATS	stats;
+
+#define	ROUNDS		20000000ul
+
+/** Address fields, as a multi-constellation receiver sends them. */
+static const char	addresses[][6] = {
+	"GPGGA", "GPVTG", "GPZDA", "GPGSA", "GPGSV", "GPGSV", "GPRMC", "GPGLL",
+	"GNGGA", "GNVTG", "GNZDA", "GNGSA", "GLGSV", "GAGSV", "GNRMC", "HEHDT",
+};
+#define	NADDRESSES	(sizeof(addresses) / sizeof(addresses[0]))
+
+/*****************************************************************************/
+/** The classifier before the descriptor table, GP talker only. */
+static SENTENCE
+classify_chain(		const uint8_t*	buffer,
+					const uint8_t	size)
+{
+	if (size==5) {
+		if (memcmp_P(buffer, PSTR("GPGGA"), 5)==0) {
+			return SENTENCE_GGA;
+		} else if (memcmp_P(buffer, PSTR("GPZDA"), 5)==0) {
+			return SENTENCE_ZDA;
+		} else if (memcmp_P(buffer, PSTR("GPVTG"), 5)==0) {
+			return SENTENCE_VTG;
+		}
+	}
+	return SENTENCE_NONE;
+}
+
+/*****************************************************************************/
+static SENTENCE
+classify_table(		GPS_PARSER*		parser,
+					const uint8_t*	buffer,
+					const uint8_t	size)
+{
+	// handle_gps_span keeps characters 2..4 of the field as they arrive.
+	parser->type[0] = buffer[2];
+	parser->type[1] = buffer[3];
+	parser->type[2] = buffer[4];
+	parser->sentence = SENTENCE_NONE;
+	gps_classify(parser, size);
+	return parser->sentence;
+}
+
+/*****************************************************************************/
+static double
+seconds_now(void)
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+int
+main(void)
+{
+	static GPS_PARSER	parser;
+	volatile uint32_t	sink = 0;
+	unsigned			accepted_chain = 0;
+	unsigned			accepted_table = 0;
+	double				start;
+	double				ns_chain;
+	double				ns_table;
+	unsigned long		r;
+	unsigned			i;
+
+	// Same answers for the GP talker, the table also takes the others.
+	for (i=0; i<NADDRESSES; ++i) {
+		const uint8_t*	a = (const uint8_t*)addresses[i];
+		const SENTENCE	chain = classify_chain(a, 5);
+		const SENTENCE	table = classify_table(&parser, a, 5);
+
+		if (chain != SENTENCE_NONE) {
+			++accepted_chain;
+		}
+		if (table != SENTENCE_NONE) {
+			++accepted_table;
+		}
+		if (a[0]=='G' && a[1]=='P' && chain != table) {
+			printf("FAIL: %s is %d by the chain, %d by the table\n", addresses[i], chain, table);
+			return 1;
+		}
+	}
+
+	start = seconds_now();
+	for (r=0; r<ROUNDS; ++r) {
+		sink += classify_chain((const uint8_t*)addresses[r % NADDRESSES], 5);
+	}
+	ns_chain = (seconds_now() - start) * 1e9 / ROUNDS;
+
+	start = seconds_now();
+	for (r=0; r<ROUNDS; ++r) {
+		sink += classify_table(&parser, (const uint8_t*)addresses[r % NADDRESSES], 5);
+	}
+	ns_table = (seconds_now() - start) * 1e9 / ROUNDS;
+
+	printf("%u address fields, %u accepted by the memcmp_P chain, %u by the table\n", (unsigned)NADDRESSES, accepted_chain, accepted_table);
+	printf("memcmp_P chain: %.2f ns per field\n", ns_chain);
+	printf("hashed table:   %.2f ns per field\n", ns_table);
+	return 0;
+}
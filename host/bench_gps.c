@@ -0,0 +1,285 @@
+// vim: ts=4 shiftwidth=4
+/** NMEA parser throughput on the host, to compare parser changes before they go onto hardware.
+ *
+ *	host/build/bench_gps [capture ...]
+ *
+ * Captures are NMEA text, such as the gps.txt that out.py replays. Synthetic 10, 20 and 50 Hz
+ * streams are always run. Each stream is fed through handle_gps_span in ring-sized spans, as
+ * main.c does, and reports bytes/s, sentences/s and ns/byte, in total and per sentence type.
+ * Link load is the share of a 38400 baud receiver port the stream needs at its rate.
+ */
+#include <stdint.h>	// uint8_t, etc.
+#include <stdio.h>	// printf
+#include <stdlib.h>	// malloc
+#include <string.h>	// memcpy
+#include <time.h>	// clock_gettime
+#include "gps.h"
+
+/** gps.c counts sentences here, main.c defines it on the AVR. */
+STATS	stats;
+
+/** Spans passed to handle_gps_span, the UART0 receive ring. */
+#define	BENCH_SPAN			256
+/** Each measurement repeats the stream for at least this long. */
+#define	BENCH_SECONDS		0.25
+/** Bytes per second of a 38400 baud 8N1 port. */
+#define	LINK_BYTES_PER_SECOND	3840.0
+/** Length of the synthetic streams. */
+#define	SYNTHETIC_SECONDS	60
+
+/** Sentence types are grouped by the 3 letters after the talker ID, up to this many. */
+#define	MAX_TYPES			16
+
+typedef struct {
+	uint8_t*	data;
+	size_t		size;
+	size_t		capacity;
+	uint32_t	sentences;
+} BUFFER;
+
+typedef struct {
+	char		type[4];
+	BUFFER		buffer;
+} TYPE_STREAM;
+
+/*****************************************************************************/
+static void
+buffer_append(		BUFFER*			b,
+					const void*		data,
+					const size_t	size)
+{
+	if (b->size + size > b->capacity) {
+		b->capacity = (b->size + size) * 2;
+		b->data = realloc(b->data, b->capacity);
+		if (b->data == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+/*****************************************************************************/
+static double
+seconds_now(void)
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+/** One pass over the stream, returns the number of sentences with values. */
+static uint32_t
+parse_stream(		const BUFFER*	b)
+{
+	GPS_PARSER	parser;
+	GPS_DATA	data;
+	uint32_t	decoded = 0;
+	size_t		done = 0;
+
+	memset(&parser, 0, sizeof(parser));
+	while (done < b->size) {
+		const uint16_t	span = b->size - done < BENCH_SPAN ? b->size - done : BENCH_SPAN;
+		uint16_t		span_done = 0;
+
+		while (span_done < span) {
+			SENTENCE	sentence;
+			span_done += handle_gps_span(&parser, b->data + done + span_done, span - span_done, &sentence, &data);
+			if (sentence != SENTENCE_NONE) {
+				++decoded;
+			}
+		}
+		done += span;
+	}
+	return decoded;
+}
+
+/*****************************************************************************/
+/** Host nanoseconds per byte of the stream, and the sentences with values in one pass. */
+static double
+time_stream(		const BUFFER*	b,
+					uint32_t*		decoded)
+{
+	const double	start = seconds_now();
+	double			elapsed;
+	uint32_t		passes = 0;
+
+	do {
+		*decoded = parse_stream(b);
+		++passes;
+		elapsed = seconds_now() - start;
+	} while (elapsed < BENCH_SECONDS);
+
+	return elapsed * 1e9 / ((double)b->size * passes);
+}
+
+/*****************************************************************************/
+/** Split the stream into one stream per sentence type. Returns the number of types. */
+static unsigned
+split_by_type(		const BUFFER*	b,
+					TYPE_STREAM*	types)
+{
+	unsigned	ntypes = 0;
+	size_t		i = 0;
+
+	while (i < b->size) {
+		size_t		end = i;
+		char		type[4] = "?  ";
+		unsigned	t;
+
+		while (end < b->size && b->data[end] != '\n') {
+			++end;
+		}
+		if (end < b->size) {
+			++end;
+		}
+		if (end - i > 6 && b->data[i] == '$') {
+			memcpy(type, b->data + i + 3, 3);
+		}
+		for (t=0; t<ntypes && memcmp(types[t].type, type, 3)!=0; ++t) {
+		}
+		if (t == ntypes) {
+			if (ntypes == MAX_TYPES) {
+				// Rare types go with the last one.
+				t = MAX_TYPES - 1;
+			} else {
+				memset(&types[t], 0, sizeof(types[t]));
+				memcpy(types[t].type, type, 4);
+				++ntypes;
+			}
+		}
+		buffer_append(&types[t].buffer, b->data + i, end - i);
+		++types[t].buffer.sentences;
+		i = end;
+	}
+	return ntypes;
+}
+
+/*****************************************************************************/
+/** Report a stream that lasts \c stream_seconds on the wire, 0 when unknown. */
+static void
+bench(				const char*		name,
+					const BUFFER*	b,
+					const double	stream_seconds)
+{
+	TYPE_STREAM	types[MAX_TYPES];
+	unsigned	ntypes;
+	unsigned	t;
+	uint32_t	decoded;
+	double		ns;
+
+	ns = time_stream(b, &decoded);
+	printf("%s: %zu bytes, %u sentences, %u with values", name, b->size, b->sentences, decoded);
+	if (stream_seconds > 0) {
+		printf(", %.0f bytes/s on the wire, link load %.0f%%", b->size / stream_seconds, 100.0 * b->size / stream_seconds / LINK_BYTES_PER_SECOND);
+	}
+	printf("\n  %-5s %9s %11s %13s %8s\n", "TYPE", "SENTENCES", "BYTES/S", "SENTENCES/S", "NS/BYTE");
+	printf("  %-5s %9u %11.0f %13.0f %8.2f\n", "all", b->sentences, 1e9 / ns, 1e9 / ns * b->sentences / b->size, ns);
+
+	ntypes = split_by_type(b, types);
+	for (t=0; t<ntypes; ++t) {
+		const BUFFER*	tb = &types[t].buffer;
+		ns = time_stream(tb, &decoded);
+		printf("  %-5s %9u %11.0f %13.0f %8.2f\n", types[t].type, tb->sentences, 1e9 / ns, 1e9 / ns * tb->sentences / tb->size, ns);
+		free(tb->data);
+	}
+}
+
+/*****************************************************************************/
+static void
+append_sentence(	BUFFER*			b,
+					const char*		body)
+{
+	char		line[128];
+	uint8_t		checksum = 0;
+	const char*	p;
+
+	for (p=body; *p!=0; ++p) {
+		checksum ^= (uint8_t)*p;
+	}
+	snprintf(line, sizeof(line), "$%s*%02X\r\n", body, checksum);
+	buffer_append(b, line, strlen(line));
+	++b->sentences;
+}
+
+/*****************************************************************************/
+/** Receiver output at \c rate Hz: GGA, VTG and ZDA every epoch, GSA and three GSV once a second. */
+static void
+synthetic_stream(	BUFFER*			b,
+					const unsigned	rate)
+{
+	const unsigned	hundredths = 100 / rate;
+	unsigned		epoch;
+
+	for (epoch=0; epoch<SYNTHETIC_SECONDS*rate; ++epoch) {
+		const unsigned	t = 12*360000u + epoch * hundredths;
+		const unsigned	hh = t / 360000u;
+		const unsigned	mm = t / 6000u % 60;
+		const unsigned	ss = t / 100u % 60;
+		const unsigned	cc = t % 100;
+		char			body[112];
+
+		snprintf(body, sizeof(body), "GPGGA,%02u%02u%02u.%02u,5925.%05u,N,02445.%05u,E,2,11,0.9,31.5,M,18.2,M,3.0,0120",
+			hh, mm, ss, cc, 12345 + epoch % 1000, 67890 + epoch % 700);
+		append_sentence(b, body);
+		snprintf(body, sizeof(body), "GPVTG,%u.%02u,T,%u.%02u,M,11.3,N,20.9,K,D",
+			(epoch/7) % 360, epoch % 100, (epoch/7 + 8) % 360, epoch % 100);
+		append_sentence(b, body);
+		snprintf(body, sizeof(body), "GPZDA,%02u%02u%02u.%02u,17,10,2026,00,00", hh, mm, ss, cc);
+		append_sentence(b, body);
+		if (epoch % rate == 0) {
+			append_sentence(b, "GPGSA,A,3,02,05,06,09,12,17,19,24,25,29,,,1.6,0.9,1.3");
+			append_sentence(b, "GPGSV,3,1,11,02,45,102,44,05,23,055,38,06,67,192,47,09,12,311,33");
+			append_sentence(b, "GPGSV,3,2,11,12,38,254,42,17,05,021,,19,52,134,45,24,29,287,40");
+			append_sentence(b, "GPGSV,3,3,11,25,18,231,36,29,08,344,30,31,,,");
+		}
+	}
+}
+
+/*****************************************************************************/
+int
+main(				int				argc,
+					char**			argv)
+{
+	static const unsigned	rates[] = { 10, 20, 50 };
+	unsigned				i;
+	int						a;
+
+	for (i=0; i<sizeof(rates)/sizeof(rates[0]); ++i) {
+		BUFFER	b = { 0 };
+		char	name[32];
+
+		synthetic_stream(&b, rates[i]);
+		snprintf(name, sizeof(name), "synthetic %u Hz", rates[i]);
+		bench(name, &b, SYNTHETIC_SECONDS);
+		free(b.data);
+	}
+
+	for (a=1; a<argc; ++a) {
+		BUFFER	b = { 0 };
+		FILE*	f = fopen(argv[a], "rb");
+		int		c;
+
+		if (f == NULL) {
+			perror(argv[a]);
+			return 1;
+		}
+		// Lines end in CR LF, as from the receiver.
+		while ((c = fgetc(f)) != EOF) {
+			const uint8_t	ch = c;
+			if (ch == '\n') {
+				buffer_append(&b, "\r", 1);
+				++b.sentences;
+			}
+			if (ch != '\r') {
+				buffer_append(&b, &ch, 1);
+			}
+		}
+		fclose(f);
+		bench(argv[a], &b, 0);
+		free(b.data);
+	}
+	return 0;
+}
@@ -0,0 +1,526 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_firmware_h_
+#define host_firmware_h_
+
+/** main.c on the host, with a model of Timer1 and the PPS compare output.
+ *
+ * Include from one harness only: the harness reaches the static time code of main.c, and its
+ * main() is renamed firmware_main. Link with host/avr.c, usart.c, gps.c, setup.c, trig.c
+ * and profile.c.
+ *
+ * The model runs Timer1 from a crystal with a frequency error in ppm, which may drift and wander.
+ * It raises the overflow and compare flags at their exact counts, switches OC1B as the compare unit
+ * would, and reports each rising edge of OC1B. The ISRs run when their flag is up and interrupts
+ * are enabled. Code can take time: with code_counts set, the count runs on by that much after every
+ * TCNT1 access, and the register writes of the code reach the counter only at its next TCNT1 access
+ * or its end. The UART rings are sent at once, to model_transmit, and model_receive puts a byte
+ * through the RX interrupt.
+ * model_zda feeds a time sentence, model_pps_error measures a rising edge against true time.
+ * Run each scenario in a fresh process (model_fork): main.c keeps its state in statics.
+ */
+
+#include <math.h>	// sin
+#include <stdio.h>	// printf
+#include <stdlib.h>	// exit
+#include <sys/wait.h>	// waitpid
+#include <unistd.h>	// fork
+
+// Each harness uses some of the helpers below.
+#pragma GCC diagnostic ignored "-Wunused-function"
+
+#define	main	firmware_main
+#include "../main.c"
+#undef	main
+
+ISR(USART0_RX_vect);
+ISR(USART1_RX_vect);
+ISR(USART2_RX_vect);
+ISR(USART3_RX_vect);
+ISR(USART0_UDRE_vect);
+ISR(USART1_UDRE_vect);
+ISR(USART2_UDRE_vect);
+ISR(USART3_UDRE_vect);
+
+/** Timer1 counts from an event to the ISR reading TCNT1, about 30 CPU cycles. */
+#define	MODEL_ISR_LATENCY	4
+/** Rising edges held while code runs, see model_rise. */
+#define	MODEL_RISES			8
+
+/** 2026-10-17 00:00:00 UTC, seconds since 2000-01-01. Time 0 of the model. */
+#define	MODEL_EPOCH		845510400ul
+/** From the '$' of a time sentence to the end of its parse, see model_zda. */
+#define	MODEL_PARSE_SECONDS	0.010
+
+typedef struct {
+	/** Crystal error, ppm: ppm + drift*time + wander*sin(2*pi*time/wander_period). */
+	double		ppm;
+	double		drift;
+	double		wander;
+	double		wander_period;
+	/** True time, seconds since MODEL_EPOCH. */
+	double		time;
+	/** Timer1 count, with the fraction of the next count. */
+	double		count;
+	/** OC1B level. */
+	bool		pin;
+	/** Time error of the receiver, seconds. The PPS follows it, see model_pps_error. */
+	double		receiver_error;
+	/** Called on each rising edge of OC1B, by the compare unit or in software. */
+	void		(*rise)(const uint32_t count, const double time);
+	/** Timer1 counts the code runs on after each TCNT1 access, 0 when code takes no time. */
+	uint16_t	code_counts;
+	/** Code is running, and the count it has reached. */
+	bool		in_code;
+	uint32_t	cpu;
+	/** Compare settings the counter runs with, as the code left them at its last TCNT1 access. */
+	uint16_t	ocr1a;
+	uint16_t	ocr1b;
+	uint8_t		com1b;
+	/** Interrupt flags up. */
+	bool		ovf_flag;
+	bool		compa_flag;
+	bool		compb_flag;
+	/** Rising edges while code runs, reported when it is done. */
+	uint8_t		rises;
+	uint32_t	rise_count[MODEL_RISES];
+	double		rise_time[MODEL_RISES];
+} TIMER1_MODEL;
+
+/** PPS error statistics, seconds. */
+typedef struct {
+	double		sum_squares;
+	double		max;
+	long		count;
+} MODEL_ERRORS;
+
+static TIMER1_MODEL		model;
+/** Takes each byte the UARTs send, NULL drops them. */
+static void				(*model_transmit)(const uint8_t port, const uint8_t data) = NULL;
+/** Takes the time sentences, a harness may put a reference algorithm here. */
+static void				(*model_handle_time)(const uint8_t rx, const SENTENCE sentence, const EPOCH_TIME* gps_time) = handle_gps_time;
+
+/*****************************************************************************/
+/** Counts per true second now. */
+static double
+model_rate(void)
+{
+	double	ppm = model.ppm + model.drift * model.time;
+	if (model.wander_period > 0) {
+		ppm += model.wander * sin(2 * M_PI * model.time / model.wander_period);
+	}
+	return TIMER1_HZ * (1 + ppm * 1e-6);
+}
+
+/*****************************************************************************/
+/** Next count after \c now that matches the 16-bit compare value. */
+static uint32_t
+model_next_match(	const uint32_t	now,
+					const uint16_t	compare)
+{
+	uint32_t	next = (now & 0xFFFF0000ul) | compare;
+	if (next <= now) {
+		next += 0x10000ul;
+	}
+	return next;
+}
+
+/*****************************************************************************/
+/** Report a rising edge of OC1B, once the code running is done: the harness reads its state. */
+static void
+model_rise(			const uint32_t	count,
+					const double	time)
+{
+	if (model.rise == NULL) {
+		return;
+	}
+	if (!model.in_code) {
+		model.rise(count, time);
+	} else if (model.rises < MODEL_RISES) {
+		model.rise_count[model.rises] = count;
+		model.rise_time[model.rises] = time;
+		++model.rises;
+	}
+}
+
+/*****************************************************************************/
+/** Run the counter to the next event, count \c target or true time \c end, whichever comes first:
+ * raise the flags and switch OC1B with the compare settings taken by model_latch. */
+static void
+model_step(			const uint32_t	target,
+					const double	end)
+{
+	const double	rate = model_rate();
+	const uint32_t	now = (uint32_t)model.count;
+	uint32_t		event = (now | 0xFFFFul) + 1;
+	double			event_time;
+
+	if (model_next_match(now, model.ocr1a) < event) {
+		event = model_next_match(now, model.ocr1a);
+	}
+	if (model_next_match(now, model.ocr1b) < event) {
+		event = model_next_match(now, model.ocr1b);
+	}
+
+	// Counts are short against the frequency changes, one rate per step is enough.
+	if (target < event) {
+		event_time = model.time + (target - model.count) / rate;
+		if (event_time <= end) {
+			model.time = event_time;
+			model.count = target;
+			return;
+		}
+	}
+	event_time = model.time + (event - model.count) / rate;
+	if (event_time > end) {
+		model.count += (end - model.time) * rate;
+		model.time = end;
+		return;
+	}
+	model.time = event_time;
+	model.count = event;
+
+	if ((uint16_t)event == 0) {
+		model.ovf_flag = true;
+		TIFR1 |= _BV(TOV1);
+	}
+	if ((uint16_t)event == model.ocr1a) {
+		model.compa_flag = true;
+	}
+	if ((uint16_t)event == model.ocr1b) {
+		if (model.com1b == (_BV(COM1B1) | _BV(COM1B0))) {
+			if (!model.pin) {
+				model_rise(event, event_time);
+			}
+			model.pin = true;
+		} else if (model.com1b == _BV(COM1B1)) {
+			model.pin = false;
+		}
+		model.compb_flag = true;
+	}
+}
+
+/*****************************************************************************/
+/** The counter takes the register writes of the code. OC1B follows PORTB while the compare unit
+ * is disconnected, and takes the level pps_set_level_isr put on PORTB when it forces the latch. */
+static void
+model_latch(void)
+{
+	const bool	pin = model.pin;
+
+	model.ocr1a = OCR1A;
+	model.ocr1b = OCR1B;
+	model.com1b = TCCR1A & (_BV(COM1B1) | _BV(COM1B0));
+	// Writing a one clears a flag, a zero leaves it.
+	if (TIFR1 & _BV(OCF1B)) {
+		model.compb_flag = false;
+	}
+	TIFR1 = model.ovf_flag ? _BV(TOV1) : 0;
+	if ((TCCR1C & _BV(FOC1B)) || model.com1b == 0) {
+		model.pin = (PORTB & _BV(PB6)) != 0;
+	}
+	TCCR1C = 0;
+	if (model.pin && !pin) {
+		model_rise((uint32_t)model.count, model.time);
+	}
+}
+
+/*****************************************************************************/
+/** TCNT1 as the code reads it: the counter runs to the count the code has reached and takes its
+ * register writes, then the code runs on for code_counts. */
+static uint16_t
+model_tcnt1(void)
+{
+	uint16_t	count;
+
+	if (!model.in_code) {
+		return (uint16_t)model.count;
+	}
+	while ((int32_t)(model.cpu - (uint32_t)model.count) > 0) {
+		model_step(model.cpu, INFINITY);
+	}
+	model_latch();
+	count = (uint16_t)model.cpu;
+	model.cpu += model.code_counts;
+	return count;
+}
+
+/*****************************************************************************/
+/** Run \c code from count \c start. Afterwards the counter is where the code ended. */
+static void
+model_code(			void			(*code)(void),
+					const uint32_t	start)
+{
+	uint8_t	i;
+
+	model.in_code = true;
+	model.cpu = start;
+	code();
+	model_tcnt1();
+	model.in_code = false;
+	for (i=0; i<model.rises; ++i) {
+		model.rise(model.rise_count[i], model.rise_time[i]);
+	}
+	model.rises = 0;
+}
+
+/*****************************************************************************/
+/** Run an ISR, MODEL_ISR_LATENCY after now. The part disables interrupts in it. */
+static void
+model_isr(			void			(*isr)(void))
+{
+	const uint8_t	sreg = SREG;
+
+	cli();
+	model_code(isr, (uint32_t)model.count + MODEL_ISR_LATENCY);
+	SREG = sreg;
+}
+
+/*****************************************************************************/
+/** Byte \c data arrives on UART \c port now, without errors. */
+static void
+model_receive(		const uint8_t	port,
+					const uint8_t	data)
+{
+	switch (port) {
+	case 0:
+		UCSR0A = 0;
+		UDR0 = data;
+		model_isr(USART0_RX_vect);
+		break;
+	case 1:
+		UCSR1A = 0;
+		UDR1 = data;
+		model_isr(USART1_RX_vect);
+		break;
+	case 2:
+		UCSR2A = 0;
+		UDR2 = data;
+		model_isr(USART2_RX_vect);
+		break;
+	case 3:
+		UCSR3A = 0;
+		UDR3 = data;
+		model_isr(USART3_RX_vect);
+		break;
+	}
+}
+
+/*****************************************************************************/
+/** Send everything queued on the UARTs, to model_transmit. */
+#define	MODEL_DRAIN(n) \
+	while (UCSR##n##B & _BV(UDRIE##n)) { \
+		const uint32_t	sent = stats.uart[n].tx_bytes; \
+		USART##n##_UDRE_vect(); \
+		if (model_transmit != NULL && stats.uart[n].tx_bytes != sent) { \
+			model_transmit(n, UDR##n); \
+		} \
+	}
+
+static void
+model_drain(void)
+{
+	MODEL_DRAIN(0)
+	MODEL_DRAIN(1)
+	MODEL_DRAIN(2)
+	MODEL_DRAIN(3)
+}
+
+/*****************************************************************************/
+/** Run Timer1 and its interrupts up to true time \c end. */
+static void
+model_run_until(	const double	end)
+{
+	while (model.time < end) {
+		// In the order of the vectors.
+		if ((SREG & 0x80) && model.compa_flag && (TIMSK1 & _BV(OCIE1A))) {
+			model.compa_flag = false;
+			model_isr(TIMER1_COMPA_vect);
+		} else if ((SREG & 0x80) && model.compb_flag && (TIMSK1 & _BV(OCIE1B))) {
+			model.compb_flag = false;
+			model_isr(TIMER1_COMPB_vect);
+		} else if ((SREG & 0x80) && model.ovf_flag && (TIMSK1 & _BV(TOIE1))) {
+			model.ovf_flag = false;
+			TIFR1 &= ~_BV(TOV1);
+			model_isr(TIMER1_OVF_vect);
+		} else {
+			model_step(UINT32_MAX, end);
+		}
+		model_drain();
+	}
+}
+
+/*****************************************************************************/
+static void
+model_start(void)
+{
+	io_Init();
+	uart_Init();
+}
+
+/*****************************************************************************/
+/** Start the firmware as main() does, with the default setup. */
+static void
+model_init(			const double	ppm,
+					const double	drift,
+					const double	wander,
+					const double	wander_period)
+{
+	memset(&model, 0, sizeof(model));
+	model.ppm = ppm;
+	model.drift = drift;
+	model.wander = wander;
+	model.wander_period = wander_period;
+
+	avr_tcnt1_hook = model_tcnt1;
+	model_code(model_start, 0);
+	sei();
+
+	setup.version = SETUP_VERSION;
+	setup.realtime_show = false;
+	setup.pulse_length = 100;
+	setup.pulse_offset = 0;
+	setup.offset_limit = 10;
+	setup.jump_limit = 2000;
+	setup.reaction_speed = 10;
+	strcpy(setup.compass_sentence, "HDHDT");
+	setup.heading_source = HEADING_SOURCE_VTG;
+	setup.heading_baseline = 5;
+	setup.heading_rate = HEADINGS_PER_SECOND;
+}
+
+/*****************************************************************************/
+static uint8_t			model_rx;
+static const EPOCH_TIME*	model_time;
+
+static void
+model_stamp(void)
+{
+	cli();
+	gettimestamp_isr(receivers[model_rx].start);
+	sei();
+}
+
+static void
+model_parsed(void)
+{
+	model_handle_time(model_rx, SENTENCE_ZDA, model_time);
+}
+
+/*****************************************************************************/
+/** The '$' of a time sentence from receiver \c rx arrives now, stamped as by the RX interrupt. */
+static void
+model_sentence_start(	const uint8_t	rx)
+{
+	model_rx = rx;
+	model_code(model_stamp, (uint32_t)model.count);
+}
+
+/*****************************************************************************/
+/** The ZDA from receiver \c rx has been parsed now. It says \c ticks since MODEL_EPOCH,
+ * off by \c error_ticks. */
+static void
+model_sentence_end(		const uint8_t	rx,
+						const uint32_t	ticks,
+						const int32_t	error_ticks)
+{
+	EPOCH_TIME	t;
+
+	t.seconds = MODEL_EPOCH + ticks / PRECISION_TICKS_PER_SECOND;
+	t.ticks = ticks % PRECISION_TICKS_PER_SECOND;
+	epoch_add(&t, error_ticks);
+	model_rx = rx;
+	model_time = &t;
+	model_code(model_parsed, (uint32_t)model.count);
+	model_drain();
+}
+
+/*****************************************************************************/
+/** Standard normal deviate. */
+static double
+model_gaussian(void)
+{
+	const double	u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	const double	v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+/*****************************************************************************/
+/** A ZDA from receiver \c rx for true time \c ticks since MODEL_EPOCH, saying it off by
+ * \c error_ticks. Its '$' arrives then, with Gaussian noise of \c noise_ms, and it is parsed
+ * MODEL_PARSE_SECONDS later. */
+static void
+model_zda(			const uint8_t	rx,
+					const uint32_t	ticks,
+					const double	noise_ms,
+					const int32_t	error_ticks)
+{
+	const double	arrival = ticks * 1e-3 + model_gaussian() * noise_ms * 1e-3;
+
+	model_run_until(arrival);
+	model_sentence_start(rx);
+	model_run_until(arrival + MODEL_PARSE_SECONDS);
+	model_sentence_end(rx, ticks, error_ticks);
+}
+
+/*****************************************************************************/
+/** PPS error of a rising edge at \c count, \c time: when it should have been, by the firmware's
+ * time of the edge and setup.pulse_offset, against when it was. Shifted by the receiver's own
+ * error, which the PPS follows. Seconds, positive is late. The second of the pulse goes to
+ * \c second, unless NULL. */
+static double
+model_pps_error(	const uint32_t	count,
+					const double	time,
+					int32_t*		second)
+{
+	const double	phase = (double)((PRECISION_TICKS_PER_SECOND - setup.pulse_offset) % PRECISION_TICKS_PER_SECOND) / PRECISION_TICKS_PER_SECOND;
+	EPOCH_TIME		t;
+	int32_t			s;
+
+	epoch_of_count(&t, count, NULL);
+	s = (int32_t)floor((double)(t.seconds - MODEL_EPOCH) + (double)t.ticks / PRECISION_TICKS_PER_SECOND - phase + 0.5);
+	if (second != NULL) {
+		*second = s;
+	}
+	return time + model.receiver_error - (s + phase);
+}
+
+/*****************************************************************************/
+static void
+model_errors_add(	MODEL_ERRORS*	errors,
+					const double	e)
+{
+	errors->sum_squares += e * e;
+	if (fabs(e) > errors->max) {
+		errors->max = fabs(e);
+	}
+	++errors->count;
+}
+
+/*****************************************************************************/
+static double
+model_errors_rms(	const MODEL_ERRORS*	errors)
+{
+	return errors->count > 0 ? sqrt(errors->sum_squares / errors->count) : 0;
+}
+
+/*****************************************************************************/
+/** Run \c scenario in a child process, so every run starts from fresh statics. Returns its exit status. */
+static int
+model_fork(			int				(*scenario)(const int),
+					const int		index)
+{
+	int		status = 1;
+	pid_t	pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		exit(scenario(index));
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+		return 1;
+	}
+	return WEXITSTATUS(status);
+}
+
+#endif /* host_firmware_h_ */
@@ -0,0 +1,271 @@
+// vim: ts=4 shiftwidth=4
+/** Replay NMEA logs through the main loop of main.c, on the Timer1 model of host/firmware.h.
+ *
+ *	host/build/replay [-p ppm] [-o uart1.out] log ...
+ *
+ * Logs are NMEA text, such as the gps.txt that out.py replays, sent to UART0 at 38400 baud. They
+ * set the clock: a GGA, RMC or ZDA with a new time starts its epoch at that time, the first one
+ * at time 0, and the other sentences follow back to back. The main loop runs after every byte
+ * and every millisecond in between. The crystal is off by ppm, 0 when not given. Only ZDA sets
+ * the firmware's time, as on the board.
+ *
+ * Each rising PPS edge goes to stdout: the log's time of day at the edge, the firmware's second
+ * of the pulse and its error against the log's second, in us. The bytes sent on UART1, the GPS
+ * echo and the headings, go to the -o file. A summary goes to stderr.
+ */
+#include <math.h>	// floor
+#include <stdio.h>	// printf
+#include <stdlib.h>	// atof
+#include <string.h>	// strncmp
+#include <time.h>	// clock_gettime
+#include "firmware.h"
+
+/** Main loop runs while the line is idle, seconds. */
+#define	REPLAY_POLL_SECONDS		0.001
+/** Seconds per byte at 38400 baud, 8N1. */
+#define	REPLAY_BYTE_SECONDS		(10.0 / UART0_BAUD_RATE)
+/** Run on after the last byte, seconds. */
+#define	REPLAY_TAIL_SECONDS		2.0
+/** Edges this long after the first are in the error summary, the rest is lock-in. */
+#define	REPLAY_SETTLE_SECONDS	60.0
+
+typedef struct {
+	char*		data;
+	size_t		size;
+	size_t		capacity;
+} TEXT;
+
+/** Log time of day at model time 0. */
+static double		log_start;
+static FILE*		uart1_out = NULL;
+static uint32_t		uart1_bytes = 0;
+static double		first_edge = -1;
+static MODEL_ERRORS	errors;
+
+/*****************************************************************************/
+static double
+seconds_now(void)
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+static void
+text_append(		TEXT*			t,
+					const char		c)
+{
+	if (t->size == t->capacity) {
+		t->capacity = t->capacity * 2 + 4096;
+		t->data = realloc(t->data, t->capacity);
+		if (t->data == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	t->data[t->size++] = c;
+}
+
+/*****************************************************************************/
+/** Time of day of a GGA, RMC or ZDA line, seconds. Returns false for other lines. */
+static bool
+line_time(			const char*		line,
+					const size_t	size,
+					double*			time)
+{
+	unsigned	hh;
+	unsigned	mm;
+	double		ss;
+
+	if (size < 14 || line[0] != '$' || line[6] != ','
+		|| (strncmp(line + 3, "GGA", 3) != 0 && strncmp(line + 3, "RMC", 3) != 0 && strncmp(line + 3, "ZDA", 3) != 0)) {
+		return false;
+	}
+	if (sscanf(line + 7, "%2u%2u%lf", &hh, &mm, &ss) != 3 || hh > 23 || mm > 59 || ss >= 61) {
+		return false;
+	}
+	*time = hh * 3600.0 + mm * 60.0 + ss;
+	return true;
+}
+
+/*****************************************************************************/
+static void
+on_transmit(		const uint8_t	port,
+					const uint8_t	data)
+{
+	if (port == 1) {
+		++uart1_bytes;
+		if (uart1_out != NULL) {
+			fputc(data, uart1_out);
+		}
+	}
+}
+
+/*****************************************************************************/
+/** A rising PPS edge: the firmware's second of the pulse against the log's. */
+static void
+on_rise(			const uint32_t	count,
+					const double	time)
+{
+	const double	phase = (double)((PRECISION_TICKS_PER_SECOND - setup.pulse_offset) % PRECISION_TICKS_PER_SECOND) / PRECISION_TICKS_PER_SECOND;
+	const double	log_time = fmod(log_start + time, 86400);
+	EPOCH_TIME		t;
+	double			second;
+	double			error;
+	unsigned		s;
+
+	epoch_of_count(&t, count, NULL);
+	second = floor((double)(t.seconds % 86400) + (double)t.ticks / PRECISION_TICKS_PER_SECOND - phase + 0.5);
+	error = log_time - (second + phase);
+	error -= 86400 * floor(error / 86400 + 0.5);
+	s = (unsigned)fmod(second + 86400, 86400);
+	printf("%02u:%02u:%09.6f %02u:%02u:%02u %+10.1f\n",
+		(unsigned)(log_time / 3600), (unsigned)fmod(log_time / 60, 60), fmod(log_time, 60),
+		s / 3600, s / 60 % 60, s % 60, error * 1e6);
+
+	if (first_edge < 0) {
+		first_edge = time;
+	}
+	if (time - first_edge >= REPLAY_SETTLE_SECONDS) {
+		model_errors_add(&errors, error);
+	}
+}
+
+/*****************************************************************************/
+static void
+main_loop(void)
+{
+	handle_uarts();
+}
+
+/*****************************************************************************/
+/** Run the firmware up to model time \c end, the main loop every REPLAY_POLL_SECONDS. */
+static void
+replay_run_until(	const double	end)
+{
+	while (model.time < end) {
+		model_run_until(fmin(end, model.time + REPLAY_POLL_SECONDS));
+		model_code(main_loop, (uint32_t)model.count);
+		model_drain();
+	}
+}
+
+/*****************************************************************************/
+int
+main(				int				argc,
+					char**			argv)
+{
+	TEXT		log = { 0 };
+	double		ppm = 0;
+	double		epoch = -1;
+	double		last_time = 0;
+	double		link_free = 0;
+	double		wall;
+	uint32_t	lines = 0;
+	size_t		i;
+	int			a;
+
+	for (a=1; a<argc && argv[a][0]=='-'; a+=2) {
+		if (a + 1 >= argc) {
+			break;
+		} else if (strcmp(argv[a], "-p") == 0) {
+			ppm = atof(argv[a + 1]);
+		} else if (strcmp(argv[a], "-o") == 0) {
+			uart1_out = fopen(argv[a + 1], "wb");
+			if (uart1_out == NULL) {
+				perror(argv[a + 1]);
+				return 1;
+			}
+		} else {
+			break;
+		}
+	}
+	if (a >= argc) {
+		fprintf(stderr, "usage: %s [-p ppm] [-o uart1.out] log ...\n", argv[0]);
+		return 1;
+	}
+	for (; a<argc; ++a) {
+		FILE*	f = fopen(argv[a], "rb");
+		int		c;
+
+		if (f == NULL) {
+			perror(argv[a]);
+			return 1;
+		}
+		// Lines end in CR LF, as from the receiver.
+		while ((c = fgetc(f)) != EOF) {
+			if (c == '\n') {
+				text_append(&log, '\r');
+			}
+			if (c != '\r') {
+				text_append(&log, c);
+			}
+		}
+		fclose(f);
+	}
+
+	model_init(ppm, 0, 0, 0);
+	model.rise = on_rise;
+	model_transmit = on_transmit;
+
+	wall = seconds_now();
+	for (i=0; i<log.size; ) {
+		const char*	line = log.data + i;
+		size_t		size = 0;
+		double		time;
+
+		while (i + size < log.size && line[size] != '\n') {
+			++size;
+		}
+		if (i + size < log.size) {
+			++size;
+		}
+		if (line_time(line, size, &time)) {
+			if (epoch < 0) {
+				log_start = time;
+				last_time = time;
+			}
+			// Midnight.
+			while (time < last_time - 43200) {
+				time += 86400;
+			}
+			last_time = time;
+			if (time != epoch) {
+				epoch = time;
+				if (link_free < epoch - log_start) {
+					link_free = epoch - log_start;
+				}
+			}
+		}
+		for (; size>0; --size, ++i) {
+			replay_run_until(link_free);
+			model_receive(0, log.data[i]);
+			model_code(main_loop, (uint32_t)model.count);
+			model_drain();
+			link_free += REPLAY_BYTE_SECONDS;
+		}
+		++lines;
+	}
+	replay_run_until(link_free + REPLAY_TAIL_SECONDS);
+	wall = seconds_now() - wall;
+
+	fprintf(stderr, "%u lines, %zu bytes, %.1f s replayed in %.1f s\n", lines, log.size, model.time, wall);
+	fprintf(stderr, "sentences: %u GGA, %u VTG, %u ZDA, %u other, %u checksum errors, %u parser restarts\n",
+		stats.sentences[SENTENCE_GGA], stats.sentences[SENTENCE_VTG], stats.sentences[SENTENCE_ZDA], stats.sentences[SENTENCE_NONE],
+		stats.checksum_errors, stats.parser_restarts);
+	fprintf(stderr, "UART0: %u dropped. UART1: %u bytes sent, %u dropped\n",
+		stats.uart[0].rx_drops, uart1_bytes, stats.uart[1].tx_drops);
+	fprintf(stderr, "time: %u steps, %u jumps\n", stats.time_steps, stats.time_jumps);
+	if (errors.count > 0) {
+		fprintf(stderr, "PPS after %.0f s: %ld edges, rms %.1f us, max %.1f us\n",
+			REPLAY_SETTLE_SECONDS, errors.count, model_errors_rms(&errors) * 1e6, errors.max * 1e6);
+	} else {
+		fprintf(stderr, "PPS: no edges after %.0f s\n", REPLAY_SETTLE_SECONDS);
+	}
+	if (uart1_out != NULL) {
+		fclose(uart1_out);
+	}
+	free(log.data);
+	return 0;
+}
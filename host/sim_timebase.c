@@ -0,0 +1,189 @@
+// vim: ts=4 shiftwidth=4
+/** The Timer1 frequency loop of main.c against the step-only algorithm it replaced, on drifting
+ * crystals. Both run the firmware's timebase, PPS compare output and interrupts (host/firmware.h);
+ * the step-only one takes the time sentences the old way, stepping the clamped offset every time.
+ *
+ * 1 and 10 ZDA per second, their '$' stamped with Gaussian arrival noise. The error of each PPS
+ * rising edge is measured against true time, from 300 s on. At 1200 s the event cases send one
+ * sentence 1500 ms off, or change the receiver's time by 500 ms for good. They report the worst PPS error
+ * in the three minutes after, how long until it is back within 1 ms, and how far the frequency
+ * term strays from the crystal's true error meanwhile. Reports only, no pass/fail limits.
+ *
+ *	host/build/sim_timebase
+ */
+#include "firmware.h"
+
+#define	SIM_SECONDS			1800
+#define	SIM_SETTLE			300
+#define	SIM_NOISE_MS		0.3
+#define	SIM_EVENT_AT		1200
+#define	SIM_EVENT_SECONDS	180
+
+typedef struct {
+	const char*	name;
+	double		ppm;
+	double		drift;
+	double		wander;
+	double		wander_period;
+	/** Receiver time error from SIM_EVENT_AT, ms. */
+	int32_t		event_ms;
+	/** Does the error stay, or is it one sentence? */
+	bool		event_stays;
+} SIM_CASE;
+
+static const SIM_CASE	cases[] = {
+	{ "0 ppm",					0,		0,		0,	0,		0,		false },
+	{ "+30 ppm",				30,		0,		0,	0,		0,		false },
+	{ "-80 ppm",				-80,	0,		0,	0,		0,		false },
+	{ "+150 ppm",				150,	0,		0,	0,		0,		false },
+	{ "+20 ppm, +0.02 ppm/s",	20,		0.02,	0,	0,		0,		false },
+	{ "+40 ppm, 10 ppm/600 s",	40,		0,		10,	600,	0,		false },
+	{ "+30 ppm, 1500 ms once",	30,		0,		0,	0,		1500,	false },
+	{ "-80 ppm, 1500 ms once",	-80,	0,		0,	0,		1500,	false },
+	{ "+30 ppm, 500 ms stays",	30,		0,		0,	0,		500,	true },
+	{ "-80 ppm, 500 ms stays",	-80,	0,		0,	0,		-500,	true },
+};
+#define	NCASES	(sizeof(cases) / sizeof(cases[0]))
+
+/** ZDA per second. */
+static const uint8_t	rates[] = { 1, 10 };
+#define	NRATES	(sizeof(rates) / sizeof(rates[0]))
+
+/** PPS errors before the event, and after it, seconds. Largest error of the frequency term after
+ * the event, ppm. */
+static MODEL_ERRORS	errors;
+static MODEL_ERRORS	event_errors;
+static double		event_last_bad;
+static double		event_windup;
+
+/*****************************************************************************/
+static void
+on_rise(			const uint32_t	count,
+					const double	time)
+{
+	const double	e = model_pps_error(count, time, NULL);
+
+	if (time >= SIM_SETTLE && time < SIM_EVENT_AT) {
+		model_errors_add(&errors, e);
+	} else if (time >= SIM_EVENT_AT && time < SIM_EVENT_AT + SIM_EVENT_SECONDS) {
+		model_errors_add(&event_errors, e);
+		if (fabs(e) > 0.001) {
+			event_last_bad = time - SIM_EVENT_AT;
+		}
+	}
+}
+
+/*****************************************************************************/
+/** The step-only algorithm before the frequency loop: the two-sample average, clamped to
+ * offset_limit unless beyond jump_limit, stepped every time. Timer1 runs at its nominal rate. */
+static void
+handle_time_step_only(	const uint8_t		rx,
+						const SENTENCE		sentence,
+						const EPOCH_TIME*	gps_time)
+{
+	RECEIVER*		receiver = &receivers[rx];
+	// Whole milliseconds, as it had.
+	const int32_t	new_offset = timebase_offset(gps_time, receiver->start.count) / TIMER1_COUNTS_PER_TICK;
+	EPOCH_TIME		now;
+
+	gettimebase(&now);
+	if (is_timebase_valid()) {
+		int32_t	ofs = (receiver->last_offset + new_offset) / 2;
+		if (ofs < setup.jump_limit && -ofs < setup.jump_limit) {
+			if (ofs > setup.offset_limit) {
+				ofs = setup.offset_limit;
+			} else if (-setup.offset_limit > ofs) {
+				ofs = -setup.offset_limit;
+			}
+		}
+		receiver->last_offset = new_offset;
+		addtimebase(ofs);
+	} else {
+		EPOCH_TIME	t = *gps_time;
+		epoch_add(&t, (timer1_count() - receiver->start.count) / TIMER1_COUNTS_PER_TICK);
+		settimebase(&t);
+	}
+}
+
+/*****************************************************************************/
+/** Case \c index / 2 at rate \c rate, with the frequency loop when \c index is even. Prints one line. */
+static int
+run_case(			const int		index,
+					const uint8_t	rate)
+{
+	const SIM_CASE*	c = &cases[index / 2];
+	int32_t			n;
+
+	srand(1 + index / 2);
+	model_init(c->ppm, c->drift, c->wander, c->wander_period);
+	model.rise = on_rise;
+	if (index % 2) {
+		model_handle_time = handle_time_step_only;
+	}
+
+	for (n=1; n<=SIM_SECONDS*rate; ++n) {
+		const uint32_t	ticks = (uint32_t)n * PRECISION_TICKS_PER_SECOND / rate;
+		const bool		event = c->event_ms != 0 &&
+			(c->event_stays ? ticks >= SIM_EVENT_AT * 1000ul : ticks == SIM_EVENT_AT * 1000ul);
+
+		model_zda(0, ticks, SIM_NOISE_MS, event ? c->event_ms : 0);
+		if (event && c->event_stays) {
+			// The PPS follows the receiver, it has nothing better.
+			model.receiver_error = c->event_ms * 1e-3;
+		}
+		if (ticks >= SIM_EVENT_AT * 1000ul && ticks < (SIM_EVENT_AT + SIM_EVENT_SECONDS) * 1000ul) {
+			const double	windup = fabs(timer1_frequency * (1e6 / TIMER1_HZ) / 65536 - (model_rate() / TIMER1_HZ - 1) * 1e6);
+			if (windup > event_windup) {
+				event_windup = windup;
+			}
+		}
+	}
+	model_run_until(SIM_SECONDS + 0.5);
+
+	printf("%-24s %-10s %8.3f %8.3f", c->name, index % 2 ? "step-only" : "PI loop",
+		1e3 * model_errors_rms(&errors), 1e3 * errors.max);
+	if (c->event_ms != 0) {
+		printf(" %8.3f %6.0f", 1e3 * event_errors.max, event_last_bad);
+		if (index % 2 == 0) {
+			printf(" %7.1f", event_windup);
+		}
+	}
+	printf("\n");
+	return 0;
+}
+
+/*****************************************************************************/
+static int
+run_case_1hz(		const int		index)
+{
+	return run_case(index, 1);
+}
+
+/*****************************************************************************/
+static int
+run_case_10hz(		const int		index)
+{
+	return run_case(index, 10);
+}
+
+/*****************************************************************************/
+int
+main(void)
+{
+	int			(* const runs[NRATES])(const int) = { run_case_1hz, run_case_10hz };
+	unsigned	r;
+	unsigned	i;
+
+	for (r=0; r<NRATES; ++r) {
+		printf("%s%u ZDA/s, %d s per case, PPS error from %d s, %.1f ms arrival noise, event at %d s\n",
+			r > 0 ? "\n" : "", rates[r], SIM_SECONDS, SIM_SETTLE, SIM_NOISE_MS, SIM_EVENT_AT);
+		printf("%-24s %-10s %8s %8s %8s %6s %7s\n", "case", "algorithm", "rms ms", "max ms", "event ms", "> 1 ms", "ppm off");
+		for (i=0; i<2*NCASES; ++i) {
+			if (model_fork(runs[r], i) != 0) {
+				printf("case %u failed\n", i);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,180 @@
+// vim: ts=4 shiftwidth=4
+/** Time synchronization regression suite: handle_gps_time, the frequency loop and the PPS output
+ * of main.c, on the Timer1 model of host/firmware.h.
+ *
+ * Each scenario runs at 1 and at 10 ZDA per second from the primary receiver, their '$' stamped as
+ * by the RX interrupt, and measures every PPS rising edge against true time (model_pps_error):
+ *	- lock:     last edge off by more than 1 ms, plus twice the arrival noise, before second SETTLE;
+ *	- rms, max: edges of seconds SETTLE on, up to the receiver jump if there is one;
+ *	- recovery: last edge off by more than 1 ms after the jump, measured against the receiver's
+ *	            new time, which the PPS has to follow;
+ *	- edges:    one per measured second, a missing or extra pulse fails.
+ * Fails when any metric passes its limit. The limits are about twice the values of the loop in
+ * this tree, lock at least 30 s, so a change that makes synchronization clearly worse shows up here.
+ * The ISR time scenarios charge the Timer1 counts of the code between TCNT1 accesses
+ * (model.code_counts), and put the rise where the ZDA is handled.
+ *
+ *	host/build/test_timesync
+ */
+#include "firmware.h"
+
+#define	SETTLE				300
+/** Locked within 1 ms, plus twice the arrival noise. */
+#define	LOCK_ERROR			0.001
+#define	LOCK_NOISE			2
+
+/** ZDA per second. */
+static const uint8_t	rates[] = { 1, 10 };
+#define	NRATES	(sizeof(rates) / sizeof(rates[0]))
+
+/** Lock and recovery, seconds; rms and max, ms. */
+typedef struct {
+	double		lock;
+	double		rms;
+	double		max;
+	double		recovery;
+} LIMITS;
+
+typedef struct {
+	const char*	name;
+	/** Crystal: error, ppm, and its drift, ppm per second. */
+	double		ppm;
+	double		drift;
+	/** Gaussian noise of the '$' arrival, ms. */
+	double		noise_ms;
+	/** Receiver time changes by jump_ms at second jump_at for good, none when 0. */
+	int32_t		jump_ms;
+	int32_t		jump_at;
+	/** No ZDA for gap_length seconds every gap_every seconds, none when 0. */
+	int32_t		gap_every;
+	int32_t		gap_length;
+	int32_t		seconds;
+	/** Timer1 counts per TCNT1 access, see model.code_counts, and setup.pulse_offset, ms. */
+	uint16_t	code_counts;
+	int16_t		pulse_offset;
+	/** Limits per rate. */
+	LIMITS		limits[NRATES];
+} SCENARIO;
+
+static const SCENARIO	scenarios[] = {
+	// name						ppm		drift	noise	jump	at		gaps		seconds	code	offset
+	//		limits at 1 Hz and 10 Hz: lock, rms, max, recovery
+	{ "cold start, +50 ppm",	50,		0,		0.3,	0,		0,		0,	0,		900,	0,		0,
+		{ { 30, 0.16, 0.4, 0 }, { 30, 0.12, 0.3, 0 } } },
+	{ "1 s receiver jump",		30,		0,		0.3,	1000,	600,	0,	0,		1200,	0,		0,
+		{ { 30, 0.07, 0.2, 200 }, { 30, 0.05, 0.1, 20 } } },
+	{ "+100 ppm",				100,	0,		0.3,	0,		0,		0,	0,		1200,	0,		0,
+		{ { 250, 0.17, 0.75, 0 }, { 280, 0.19, 0.9, 0 } } },
+	{ "-100 ppm",				-100,	0,		0.3,	0,		0,		0,	0,		1200,	0,		0,
+		{ { 240, 0.15, 0.7, 0 }, { 250, 0.16, 0.7, 0 } } },
+	{ "-100 to +100 ppm drift",	-100,	0.1,	0.3,	0,		0,		0,	0,		2000,	0,		0,
+		{ { 220, 0.42, 0.9, 0 }, { 220, 0.42, 0.9, 0 } } },
+	{ "missing ZDA bursts",		60,		0.005,	0.3,	0,		0,		300,	60,	1800,	0,		0,
+		{ { 160, 0.2, 0.65, 0 }, { 180, 0.17, 0.65, 0 } } },
+	{ "2 ms latency jitter",	30,		0,		2.0,	0,		0,		0,	0,		1200,	0,		0,
+		{ { 30, 2.6, 9.0, 0 }, { 30, 2.7, 10.0, 0 } } },
+	{ "ISR time, rise at 10 ms",	30,		0,		0.3,	0,		0,		0,	0,		900,	190,	-10,
+		{ { 30, 0.07, 0.35, 0 }, { 30, 0.05, 0.16, 0 } } },
+	{ "ISR time, rise at 11 ms",	-30,	0,		0.3,	0,		0,		0,	0,		900,	400,	-11,
+		{ { 30, 0.15, 1.4, 0 }, { 30, 0.07, 0.15, 0 } } },
+};
+#define	NSCENARIOS	(sizeof(scenarios) / sizeof(scenarios[0]))
+
+/** Scenario running, and what it measured, seconds. */
+static const SCENARIO*	scenario;
+static int32_t			measured_end;
+static double			last_unlocked;
+static double			last_unrecovered;
+static MODEL_ERRORS		errors;
+
+/*****************************************************************************/
+static void
+on_rise(			const uint32_t	count,
+					const double	time)
+{
+	int32_t			second;
+	const double	e = fabs(model_pps_error(count, time, &second));
+	const double	lock_error = LOCK_ERROR + LOCK_NOISE * scenario->noise_ms * 1e-3;
+
+	if (second < SETTLE) {
+		if (e > lock_error) {
+			last_unlocked = time;
+		}
+	} else if (second < measured_end) {
+		model_errors_add(&errors, e);
+	} else if (scenario->jump_ms != 0 && e > lock_error) {
+		last_unrecovered = time - scenario->jump_at;
+	}
+}
+
+/*****************************************************************************/
+static int
+check(				const char*		what,
+					const double	value,
+					const double	limit)
+{
+	const bool	ok = value <= limit;
+	printf("    %-10s %8.3f  (limit %.3f)  %s\n", what, value, limit, ok ? "ok" : "FAIL");
+	return ok ? 0 : 1;
+}
+
+/*****************************************************************************/
+/** Scenario \c index / NRATES at rate \c index % NRATES, in a process of its own. Returns the
+ * number of failed checks. */
+static int
+run_scenario(		const int		index)
+{
+	const uint8_t	rate = rates[index % NRATES];
+	const LIMITS*	limits;
+	int32_t			n;
+	int				failures = 0;
+
+	scenario = &scenarios[index / NRATES];
+	limits = &scenario->limits[index % NRATES];
+	measured_end = scenario->jump_ms != 0 ? scenario->jump_at : scenario->seconds;
+	srand(1 + index / NRATES);
+	model_init(scenario->ppm, scenario->drift, 0, 0);
+	model.rise = on_rise;
+	model.code_counts = scenario->code_counts;
+	setup.pulse_offset = scenario->pulse_offset;
+
+	for (n=1; n<=scenario->seconds*rate; ++n) {
+		const uint32_t	ticks = (uint32_t)n * PRECISION_TICKS_PER_SECOND / rate;
+		const int32_t	second = ticks / PRECISION_TICKS_PER_SECOND;
+		const bool		jumped = scenario->jump_ms != 0 && second >= scenario->jump_at;
+
+		if (scenario->gap_every != 0 && second % scenario->gap_every >= scenario->gap_every - scenario->gap_length) {
+			continue;
+		}
+		model_zda(0, ticks, scenario->noise_ms, jumped ? scenario->jump_ms : 0);
+		if (jumped) {
+			model.receiver_error = scenario->jump_ms * 1e-3;
+		}
+	}
+	model_run_until(scenario->seconds + 0.5);
+
+	printf("%s, %u Hz\n", scenario->name, rate);
+	failures += check("lock s", last_unlocked, limits->lock);
+	failures += check("rms ms", 1e3 * model_errors_rms(&errors), limits->rms);
+	failures += check("max ms", 1e3 * errors.max, limits->max);
+	if (scenario->jump_ms != 0) {
+		failures += check("recovery s", last_unrecovered, limits->recovery);
+	}
+	failures += check("edges off", labs(measured_end - SETTLE - errors.count), 0);
+	fflush(stdout);
+	return failures;
+}
+
+/*****************************************************************************/
+int
+main(void)
+{
+	int			failures = 0;
+	unsigned	i;
+
+	for (i=0; i<NSCENARIOS*NRATES; ++i) {
+		failures += model_fork(run_scenario, i);
+	}
+	printf("%s\n", failures==0 ? "PASS" : "FAIL");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+// vim: ts=4 shiftwidth=4
+/** Accuracy of the fixed-point trigonometry in trig.c over all 36000 course values, and the VTG
+ * heading filter of main.c against the soft-float path it replaced. Fails when the kernel is off by
+ * more than 0.01 degrees, or the filter by more than 0.02 degrees from the float path, which itself
+ * truncates. Also times one filter update both ways; host times, not AVR cycles.
+ *
+ *	host/build/test_trig
+ */
+#include <stdint.h>	// int16_t, etc.
+#include <stdio.h>	// printf
+#include <stdlib.h>	// abs, rand
+#include <math.h>	// sin, cos, atan2
+#include <time.h>	// clock_gettime
+#include "trig.h"
+
+/** 0.01 degrees as Q14 error of sin and cos, 16384*sin(0.01 degrees). */
+#define	MAX_SIN_ERROR_X14		2.86
+/** atan2 error, 0.01 degrees. */
+#define	MAX_ATAN2_ERROR_X100	1
+/** Filter updates compared, and the reaction speed used. */
+#define	FILTER_UPDATES			1000000
+#define	FILTER_REACTION_SPEED	10
+/** Filtered heading, fixed against float, 0.01 degrees. */
+#define	MAX_FILTER_ERROR_X100	2
+
+static int	failures = 0;
+
+/*****************************************************************************/
+static void
+check(				const int		ok,
+					const char*		what,
+					const double	value,
+					const double	limit)
+{
+	printf("%-40s %10.4f  (limit %.4f)  %s\n", what, value, limit, ok ? "ok" : "FAIL");
+	if (!ok) {
+		++failures;
+	}
+}
+
+/*****************************************************************************/
+static void
+check_equal(		const char*		what,
+					const long		value,
+					const long		expected)
+{
+	printf("%-40s %10ld  (expected %ld)  %s\n", what, value, expected, value==expected ? "ok" : "FAIL");
+	if (value != expected) {
+		++failures;
+	}
+}
+
+/*****************************************************************************/
+/** Angle difference on the circle, 0.01 degrees. */
+static int
+angle_error_x100(	const int		a,
+					const int		b)
+{
+	int	d = abs(a - b) % 36000;
+	return d > 18000 ? 36000 - d : d;
+}
+
+/*****************************************************************************/
+static double
+seconds_now(void)
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+/** One update of the heading filter, as handle_gps_course before and after the fixed-point change. */
+typedef struct {
+	int16_t	cos_x14;
+	int16_t	sin_x14;
+} FILTER;
+
+static uint16_t
+filter_float(		FILTER*			f,
+					const uint16_t	course_x100)
+{
+	const float		course = (0.01 * 3.14159265358979323844 / 180.0) * course_x100;
+	const int16_t	icos = 16384 * cos(course);
+	const int16_t	isin = 16384 * sin(course);
+	const int32_t	f2 = 100 - FILTER_REACTION_SPEED;
+	int16_t			c0;
+
+	f->cos_x14 = (((int32_t)FILTER_REACTION_SPEED)*icos + f2*f->cos_x14)/100;
+	f->sin_x14 = (((int32_t)FILTER_REACTION_SPEED)*isin + f2*f->sin_x14)/100;
+	c0 = (100.0 * 180.0 / 3.14159265358979323844) * atan2(f->sin_x14, f->cos_x14);
+	return c0>=0 ? c0 : (c0 + 36000u);
+}
+
+static uint16_t
+filter_fixed(		FILTER*			f,
+					const uint16_t	course_x100)
+{
+	const int16_t	icos = trig_cos_x14(course_x100);
+	const int16_t	isin = trig_sin_x14(course_x100);
+	const int32_t	f2 = 100 - FILTER_REACTION_SPEED;
+
+	f->cos_x14 = (((int32_t)FILTER_REACTION_SPEED)*icos + f2*f->cos_x14)/100;
+	f->sin_x14 = (((int32_t)FILTER_REACTION_SPEED)*isin + f2*f->sin_x14)/100;
+	return trig_atan2_x100(f->sin_x14, f->cos_x14);
+}
+
+/*****************************************************************************/
+/** Courses fed to the filter: a slowly turning heading with noise, repeatable. */
+static uint16_t
+filter_course(		const long		n)
+{
+	return (n/50*977 + rand()%500) % 36000;
+}
+
+/*****************************************************************************/
+int
+main(void)
+{
+	static uint16_t	courses[FILTER_UPDATES];
+	double			max_sin = 0;
+	int				max_atan2 = 0;
+	int				max_round_trip = 0;
+	int				max_filter = 0;
+	long			digits_differ = 0;
+	FILTER			ff = { 0, 0 };
+	FILTER			fx = { 0, 0 };
+	volatile uint32_t	sink = 0;
+	double			start;
+	double			ns_float;
+	double			ns_fixed;
+	long			n;
+	int				a;
+
+	// 1. All course values.
+	for (a=0; a<36000; ++a) {
+		const double	r = a * M_PI / 18000.0;
+		const int16_t	s = trig_sin_x14(a);
+		const int16_t	c = trig_cos_x14(a);
+		double			e;
+
+		e = fabs(s - 16384*sin(r));
+		if (e > max_sin) {
+			max_sin = e;
+		}
+		e = fabs(c - 16384*cos(r));
+		if (e > max_sin) {
+			max_sin = e;
+		}
+
+		// Long vectors, as the GGA heading passes them.
+		e = angle_error_x100(trig_atan2_x100(lround(1e6*sin(r)), lround(1e6*cos(r))), a);
+		if (e > max_atan2) {
+			max_atan2 = e;
+		}
+
+		// Q14 vectors, as the VTG filter passes them.
+		e = angle_error_x100(trig_atan2_x100(s, c), a);
+		if (e > max_round_trip) {
+			max_round_trip = e;
+		}
+	}
+	check(max_sin <= MAX_SIN_ERROR_X14, "sin/cos, max error x16384", max_sin, MAX_SIN_ERROR_X14);
+	check(max_atan2 <= MAX_ATAN2_ERROR_X100, "atan2 of 1e6 vectors, max error x100 deg", max_atan2, MAX_ATAN2_ERROR_X100);
+	check(max_round_trip <= MAX_ATAN2_ERROR_X100, "atan2(sin, cos) of Q14, max error x100 deg", max_round_trip, MAX_ATAN2_ERROR_X100);
+
+	// 2. Corner cases: zero vector, axes, tiny and huge components.
+	check_equal("atan2(0, 0)", trig_atan2_x100(0, 0), 0);
+	check_equal("atan2(0, -5)", trig_atan2_x100(0, -5), 18000);
+	check_equal("atan2(-5, 0)", trig_atan2_x100(-5, 0), 27000);
+	check_equal("atan2(-1, 1e6)", trig_atan2_x100(-1, 1000000), 0);
+	check_equal("atan2(INT32_MIN, INT32_MIN)", trig_atan2_x100(INT32_MIN, INT32_MIN), 22500);
+	check_equal("sin(450 deg)", trig_sin_x14(36000u + 9000), 16384);
+
+	// 3. The heading filter, fixed against float.
+	srand(1);
+	for (n=0; n<FILTER_UPDATES; ++n) {
+		courses[n] = filter_course(n);
+	}
+	for (n=0; n<FILTER_UPDATES; ++n) {
+		const uint16_t	hf = filter_float(&ff, courses[n]);
+		const uint16_t	hx = filter_fixed(&fx, courses[n]);
+		const int		e = angle_error_x100(hf, hx);
+
+		if (e > max_filter) {
+			max_filter = e;
+		}
+		if (hf/100 != hx/100) {
+			++digits_differ;
+		}
+	}
+	check(max_filter <= MAX_FILTER_ERROR_X100, "filter, fixed - float, max x100 deg", max_filter, MAX_FILTER_ERROR_X100);
+	printf("HDG whole degrees differ in %ld of %d updates (float truncated, fixed rounds)\n", digits_differ, FILTER_UPDATES);
+
+	// 4. Cost of one filter update.
+	ff.cos_x14 = ff.sin_x14 = 0;
+	start = seconds_now();
+	for (n=0; n<FILTER_UPDATES; ++n) {
+		sink += filter_float(&ff, courses[n]);
+	}
+	ns_float = (seconds_now() - start) * 1e9 / FILTER_UPDATES;
+	fx.cos_x14 = fx.sin_x14 = 0;
+	start = seconds_now();
+	for (n=0; n<FILTER_UPDATES; ++n) {
+		sink += filter_fixed(&fx, courses[n]);
+	}
+	ns_fixed = (seconds_now() - start) * 1e9 / FILTER_UPDATES;
+	printf("filter update on the host: float %.1f ns, fixed %.1f ns\n", ns_float, ns_fixed);
+
+	printf("%s\n", failures==0 ? "PASS" : "FAIL");
+	return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+// vim: ts=4 shiftwidth=4
+/** Framing of the UART1 GPS + HDG output under load, with usart.c and gps.c as built for the AVR.
+ *
+ * Random bursts of NMEA are chunked by handle_gps_span and echoed with uart1_Write, as the main
+ * loop does. The heading slot fires at random points, and the HDG goes in between sentences as in
+ * send_heading_between_sentences. The transmitter drains at random rates, often too slowly, so
+ * whole sentences are dropped. Fails when:
+ *	- an output line is not a whole GPS sentence, in input order, or the whole HDG;
+ *	- an HDG is queued after the '$' of a GPS sentence that started after its slot;
+ *	- bytes queued and not sent differ from the 16-bit TX drop counter.
+ *
+ *	host/build/test_uart1
+ */
+#include <stdint.h>	// uint8_t, etc.
+#include <stdio.h>	// printf
+#include <stdlib.h>	// rand
+#include <string.h>	// memcmp
+#include <avr/interrupt.h>	// ISR, sei
+#include "usart.h"
+#include "gps.h"
+
+/** usart.c and gps.c count here, main.c defines it on the AVR. */
+STATS				stats;
+volatile uint16_t	timer1_overflows;
+
+/** usart.c */
+ISR(USART1_UDRE_vect);
+
+#define	ROUNDS			200000
+#define	INPUT_SIZE		(4ul << 20)
+#define	MAX_LINES		(INPUT_SIZE / 16)
+
+static const char	hdg[] = "$HDHDT,123,T*2C\r\n";
+#define	HDG_LENGTH	(sizeof(hdg) - 1)
+
+static uint8_t		input[INPUT_SIZE];
+static uint32_t		input_size = 0;
+/** Start of each input line, and one past the last. */
+static uint32_t		line_start[MAX_LINES + 1];
+static uint32_t		nlines = 0;
+
+static uint8_t		output[INPUT_SIZE * 2];
+static uint32_t		output_size = 0;
+
+/*****************************************************************************/
+/** GPS-like lines of random length, a few of them garbage without '$'. */
+static void
+make_input(void)
+{
+	while (input_size + 128 < INPUT_SIZE && nlines < MAX_LINES) {
+		const int	length = 10 + rand() % 90;
+		int			i;
+
+		line_start[nlines++] = input_size;
+		input[input_size++] = rand() % 50 ? '$' : 'x';
+		for (i=0; i<length; ++i) {
+			input[input_size++] = "GPZDAVTG0123456789,.*"[rand() % 21];
+		}
+		input[input_size++] = '\r';
+		input[input_size++] = '\n';
+	}
+	line_start[nlines] = input_size;
+}
+
+/*****************************************************************************/
+/** Send up to \c count bytes from the UART1 ring, as the UDRE interrupt would. */
+static void
+drain(				int				count)
+{
+	while (count-- > 0 && (UCSR1B & _BV(UDRIE1))) {
+		const uint32_t	sent = stats.uart[1].tx_bytes;
+		USART1_UDRE_vect();
+		if (stats.uart[1].tx_bytes != sent) {
+			output[output_size++] = UDR1;
+		}
+	}
+}
+
+/*****************************************************************************/
+int
+main(void)
+{
+	GPS_PARSER	parser;
+	GPS_DATA	data;
+	bool		should_send_heading = false;
+	/** '$' echoed while an HDG waits. */
+	int			starts_while_pending = 0;
+	uint32_t	late = 0;
+	uint32_t	queued = 0;
+	uint32_t	hdgs = 0;
+	uint32_t	lines_out = 0;
+	uint32_t	lines_dropped = 0;
+	uint32_t	bad_lines = 0;
+	uint32_t	done = 0;
+	uint32_t	next_line = 0;
+	uint32_t	o = 0;
+	int			round;
+
+	srand(1);
+	make_input();
+	memset(&parser, 0, sizeof(parser));
+	uart_Init();
+	sei();
+
+	for (round=0; round<ROUNDS && done<input_size; ++round) {
+		// 1. A burst arrives, the main loop echoes it chunk by chunk.
+		uint32_t	burst = 1 + rand() % 300;
+		if (burst > input_size - done) {
+			burst = input_size - done;
+		}
+		while (burst > 0) {
+			SENTENCE		sentence;
+			const uint16_t	span = burst < 256 ? burst : 256;
+			const uint16_t	chunk = handle_gps_span(&parser, input + done, span, &sentence, &data);
+
+			uart1_Write(input + done, chunk);
+			queued += chunk;
+			if (input[done + chunk - 1] == '$' && should_send_heading) {
+				++starts_while_pending;
+			}
+			done += chunk;
+			burst -= chunk;
+
+			// The heading slot fires anywhere.
+			if (rand() % 8 == 0 && !should_send_heading) {
+				should_send_heading = true;
+				starts_while_pending = 0;
+			}
+			// send_heading_between_sentences
+			if (should_send_heading && !uart1_IsTxInSentence()) {
+				// The sentence in progress at the slot may finish first, no other may start.
+				if (starts_while_pending > 0) {
+					++late;
+				}
+				should_send_heading = false;
+				uart1_Write((const uint8_t*)hdg, HDG_LENGTH);
+				queued += HDG_LENGTH;
+				++hdgs;
+			}
+
+			// 2. The transmitter runs meanwhile, sometimes far behind.
+			drain(rand() % 3 ? rand() % 30 : rand() % 120);
+		}
+	}
+	drain(INPUT_SIZE);
+
+	// 3. Every output line is a whole input line, in order, or the HDG.
+	while (o < output_size) {
+		const uint8_t*	end = memchr(output + o, '\n', output_size - o);
+		const uint32_t	length = end ? (uint32_t)(end - (output + o)) + 1 : output_size - o;
+
+		if (length == HDG_LENGTH && memcmp(output + o, hdg, HDG_LENGTH) == 0) {
+			// HDG
+		} else {
+			while (next_line < nlines
+				&& (line_start[next_line+1] - line_start[next_line] != length
+					|| memcmp(output + o, input + line_start[next_line], length) != 0)) {
+				++next_line;
+				++lines_dropped;
+			}
+			if (next_line == nlines) {
+				if (bad_lines++ < 5) {
+					printf("not an input line at output byte %u: %.*s\n", o, (int)length, output + o);
+				}
+			} else {
+				++next_line;
+				++lines_out;
+			}
+		}
+		o += length;
+	}
+	lines_dropped += nlines - next_line;
+
+	printf("%u input lines: %u sent whole, %u dropped whole, %u broken\n", nlines, lines_out, lines_dropped, bad_lines);
+	printf("%u HDG queued, %u late\n", hdgs, late);
+	printf("%u bytes queued, %u sent, %u dropped, counter %u\n", queued, output_size, queued - output_size, stats.uart[1].tx_drops);
+
+	if (bad_lines != 0 || late != 0 || (uint16_t)(queued - output_size) != stats.uart[1].tx_drops || lines_dropped == 0) {
+		printf("FAIL\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
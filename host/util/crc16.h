@@ -0,0 +1,23 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_util_crc16_h_
+#define host_util_crc16_h_
+
+/** Host stand-in for avr-libc <util/crc16.h>, the same CRCs in C. */
+
+#include <stdint.h>	// uint8_t
+
+/** Dallas iButton 8-bit CRC, polynomial x^8 + x^5 + x^4 + 1. */
+static inline uint8_t
+_crc_ibutton_update(	uint8_t			crc,
+						const uint8_t	data)
+{
+	uint8_t	i;
+
+	crc ^= data;
+	for (i=0; i<8; ++i) {
+		crc = (crc & 0x01) ? (crc >> 1) ^ 0x8C : crc >> 1;
+	}
+	return crc;
+}
+
+#endif /* host_util_crc16_h_ */
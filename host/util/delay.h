@@ -0,0 +1,10 @@
+// vim: ts=4 shiftwidth=4
+#ifndef host_util_delay_h_
+#define host_util_delay_h_
+
+/** Host stand-in for avr-libc <util/delay.h>, delays take no time. */
+
+#define	_delay_ms(ms)	((void)(ms))
+#define	_delay_us(us)	((void)(us))
+
+#endif /* host_util_delay_h_ */
@@ -0,0 +1,322 @@
+// vim: ts=4 shiftwidth=4
+/** Worst case time of one handle_gps_input call on the host, for adversarial input against normal traffic.
+ *
+ *	host/build/wcet_gps [budget]
+ *
+ * Every byte of every stream is timed on its own: the parser state before the byte is saved, and
+ * the call is repeated on copies of it. The least time over the repetitions is the cost of that
+ * byte, the greatest cost over a stream is its worst case. Adversarial streams have fields of
+ * GPS_MAX_FIELD_LENGTH and more, which restart the parser, checksum fields that are short, long,
+ * repeated or lower case, and ',' floods past GPS_MAX_FIELDS.
+ *
+ * Host nanoseconds are not AVR cycles, so the budget is relative: the worst adversarial call may
+ * take at most budget times the worst call of the receiver's own sentences, 2.0 when not given.
+ * Exits 1 over budget. Cycle counts on the atmega1280 need simavr or the PROFILE build.
+ */
+#include <stdint.h>	// uint8_t, etc.
+#include <stdio.h>	// printf
+#include <stdlib.h>	// atof
+#include <string.h>	// memcpy
+#include <time.h>	// clock_gettime
+#include "gps.h"
+
+/** gps.c counts sentences here, main.c defines it on the AVR. */
+STATS	stats;
+
+/** Calls timed together, so that reading the clock does not swamp one call. */
+#define	WCET_BATCH			64
+/** Batches per byte and round, the fastest one counts. */
+#define	WCET_REPEATS		10
+/** Rounds over all streams, normal and adversarial alike, so that both see the same clock speeds. */
+#define	WCET_ROUNDS			20
+/** Longest stream. */
+#define	WCET_STREAM_SIZE	512
+/** GPS_MAX_FIELD_LENGTH and GPS_MAX_FIELDS of gps.c. */
+#define	WCET_FIELD_LENGTH	64
+#define	WCET_FIELDS			20
+/** Default budget, worst adversarial call over worst normal call. */
+#define	WCET_BUDGET			2.0
+
+typedef struct {
+	const char*	name;
+	uint8_t		data[WCET_STREAM_SIZE];
+	size_t		size;
+	double		best[WCET_STREAM_SIZE];	///< least time of each byte over the rounds, with the copy
+} STREAM;
+
+/*****************************************************************************/
+static double
+seconds_now(void)
+{
+	struct timespec	ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*****************************************************************************/
+static void
+append(				STREAM*			s,
+					const char*		text)
+{
+	const size_t	size = strlen(text);
+
+	if (s->size + size > sizeof(s->data)) {
+		fprintf(stderr, "%s: stream too long\n", s->name);
+		exit(1);
+	}
+	memcpy(s->data + s->size, text, size);
+	s->size += size;
+}
+
+/*****************************************************************************/
+static void
+append_repeated(	STREAM*			s,
+					const char		c,
+					const unsigned	count)
+{
+	unsigned	i;
+
+	for (i=0; i<count; ++i) {
+		const char	text[2] = { c, 0 };
+		append(s, text);
+	}
+}
+
+/*****************************************************************************/
+/** Append "$body*XX\r\n" with the checksum of body, in \c hex (upper or lower case digits). */
+static void
+append_sentence(	STREAM*			s,
+					const char*		body,
+					const char*		hex)
+{
+	char		line[WCET_STREAM_SIZE];
+	uint8_t		checksum = 0;
+	const char*	p;
+
+	for (p=body; *p!=0; ++p) {
+		checksum ^= (uint8_t)*p;
+	}
+	snprintf(line, sizeof(line), "$%s*", body);
+	append(s, line);
+	snprintf(line, sizeof(line), hex, checksum);
+	append(s, line);
+	append(s, "\r\n");
+}
+
+/*****************************************************************************/
+/** Cost of copying the parser state, the same in every measurement. */
+static void
+time_copy(			const GPS_PARSER*	saved,
+					double*				best)
+{
+	unsigned	r;
+
+	for (r=0; r<WCET_REPEATS; ++r) {
+		const double	start = seconds_now();
+		unsigned		b;
+		for (b=0; b<WCET_BATCH; ++b) {
+			GPS_PARSER	parser = *saved;
+			__asm__ volatile ("" : : "r"(&parser) : "memory");
+		}
+		const double	elapsed = (seconds_now() - start) / WCET_BATCH;
+		if (elapsed < *best) {
+			*best = elapsed;
+		}
+	}
+}
+
+/*****************************************************************************/
+/** Cost of one handle_gps_input call on byte \c c from state \c saved, with the copy. */
+static void
+time_byte(			const GPS_PARSER*	saved,
+					const uint8_t		c,
+					double*				best)
+{
+	unsigned	r;
+
+	for (r=0; r<WCET_REPEATS; ++r) {
+		const double	start = seconds_now();
+		unsigned		b;
+		for (b=0; b<WCET_BATCH; ++b) {
+			GPS_PARSER	parser = *saved;
+			GPS_DATA	data;
+			__asm__ volatile ("" : : "r"(&parser) : "memory");
+			handle_gps_input(&parser, c, &data);
+			__asm__ volatile ("" : : "r"(&parser), "r"(&data) : "memory");
+		}
+		const double	elapsed = (seconds_now() - start) / WCET_BATCH;
+		if (elapsed < *best) {
+			*best = elapsed;
+		}
+	}
+}
+
+/*****************************************************************************/
+/** One round over the stream, keeping the least time of each byte. */
+static void
+time_stream(		STREAM*			s)
+{
+	GPS_PARSER	parser;
+	GPS_DATA	data;
+	size_t		i;
+
+	memset(&parser, 0, sizeof(parser));
+	for (i=0; i<s->size; ++i) {
+		time_byte(&parser, s->data[i], &s->best[i]);
+		handle_gps_input(&parser, s->data[i], &data);
+	}
+}
+
+/*****************************************************************************/
+/** Report the worst call of each stream, returns the worst of them all in ns. */
+static double
+report(				const char*		title,
+					const STREAM*	streams,
+					const unsigned	count,
+					const double	copy_seconds)
+{
+	double		worst = 0;
+	unsigned	i;
+
+	printf("%s\n  %-36s %6s %8s %6s\n", title, "STREAM", "BYTES", "AT", "NS");
+	for (i=0; i<count; ++i) {
+		const STREAM*	s = &streams[i];
+		size_t			at = 0;
+		size_t			j;
+		char			text[16];
+		double			ns;
+
+		for (j=1; j<s->size; ++j) {
+			if (s->best[j] > s->best[at]) {
+				at = j;
+			}
+		}
+		ns = (s->best[at] - copy_seconds) * 1e9;
+		snprintf(text, sizeof(text), s->data[at]>=' ' && s->data[at]<0x7F ? "%zu '%c'" : "%zu %02X", at, s->data[at]);
+		printf("  %-36s %6zu %8s %6.1f\n", s->name, s->size, text, ns);
+		if (ns > worst) {
+			worst = ns;
+		}
+	}
+	return worst;
+}
+
+/*****************************************************************************/
+int
+main(				int				argc,
+					char**			argv)
+{
+	static STREAM	normal[] = {
+		{ "GGA" }, { "VTG" }, { "ZDA" }, { "GSA" }, { "GSV" },
+	};
+	static STREAM	adversarial[] = {
+		{ "type field overflow" },
+		{ "time field overflow" },
+		{ "coordinate field overflow" },
+		{ "course field overflow" },
+		{ "date field overflow" },
+		{ "checksum field overflow" },
+		{ "checksum short, long, repeated" },
+		{ "checksum lower case, no CR" },
+		{ "full ZDA, longest time field" },
+		{ "full GGA, longest coordinates" },
+		{ "',' flood ZDA" },
+		{ "',' flood GGA" },
+		{ "'$' and CR LF flood" },
+	};
+	const double	budget = argc > 1 ? atof(argv[1]) : WCET_BUDGET;
+	const unsigned	nnormal = sizeof(normal) / sizeof(normal[0]);
+	const unsigned	nadversarial = sizeof(adversarial) / sizeof(adversarial[0]);
+	GPS_PARSER		idle;
+	double			copy_seconds = 1e9;
+	double			worst_normal;
+	double			worst_adversarial;
+	unsigned		i;
+	unsigned		r;
+
+	if (!(budget > 0)) {
+		fprintf(stderr, "usage: %s [budget]\n", argv[0]);
+		return 1;
+	}
+
+	append_sentence(&normal[0], "GPGGA,120000.00,5925.12345,N,02445.67890,E,2,11,0.9,31.5,M,18.2,M,3.0,0120", "%02X");
+	append_sentence(&normal[1], "GPVTG,123.45,T,131.45,M,11.3,N,20.9,K,D", "%02X");
+	append_sentence(&normal[2], "GPZDA,120000.00,17,10,2026,00,00", "%02X");
+	append_sentence(&normal[3], "GPGSA,A,3,02,05,06,09,12,17,19,24,25,29,,,1.6,0.9,1.3", "%02X");
+	append_sentence(&normal[4], "GPGSV,3,1,11,02,45,102,44,05,23,055,38,06,67,192,47,09,12,311,33", "%02X");
+
+	for (i=0; i<nnormal; ++i) {
+		for (r=0; r<WCET_STREAM_SIZE; ++r) {
+			normal[i].best[r] = 1e9;
+		}
+	}
+	for (i=0; i<nadversarial; ++i) {
+		for (r=0; r<WCET_STREAM_SIZE; ++r) {
+			adversarial[i].best[r] = 1e9;
+		}
+	}
+
+	i = 0;
+	// Fields run into the GPS_MAX_FIELD_LENGTH restart, then go on past it.
+	append(&adversarial[i], "$");
+	append_repeated(&adversarial[i++], 'G', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i], "$GPZDA,");
+	append_repeated(&adversarial[i++], '1', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i], "$GPGGA,120000.00,5925.");
+	append_repeated(&adversarial[i++], '9', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i], "$GPVTG,123.");
+	append_repeated(&adversarial[i++], '9', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i], "$GPZDA,120000.00,");
+	append_repeated(&adversarial[i++], '9', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i], "$GPZDA,120000.00,17,10,2026,00,00*");
+	append_repeated(&adversarial[i], 'F', 2*WCET_FIELD_LENGTH);
+	append(&adversarial[i++], "\r\n");
+	// Checksums the parser rejects.
+	append(&adversarial[i], "$GPZDA,120000.00,17,10,2026,00,00*\r\n");
+	append(&adversarial[i], "$GPZDA,120000.00,17,10,2026,00,00*4\r\n");
+	append(&adversarial[i], "$GPZDA,120000.00,17,10,2026,00,00*4A4A4A\r\n");
+	append(&adversarial[i], "$GPZDA,120000.00*17,10*2026,00,00*4A\r\n");
+	append(&adversarial[i++], "\r\n\r\n");
+	append_sentence(&adversarial[i], "GPZDA,120000.00,17,10,2026,00,00", "%02x");
+	append(&adversarial[i++], "$GPZDA,120000.00,17,10,2026,00,00*4A\n");
+	// Sentences that decode every value, with the most work per field.
+	append_sentence(&adversarial[i++], "GNZDA,235959.999,31,12,2099,00,00", "%02X");
+	append_sentence(&adversarial[i++], "GNGGA,235959.999,8959,S,17959,W,8,12,0.5,9999.9,M,99.9,M,9.9,1023", "%02X");
+	// Empty fields, far past GPS_MAX_FIELDS.
+	{
+		char	body[WCET_STREAM_SIZE / 2] = "GPZDA";
+		memset(body + 5, ',', 4*WCET_FIELDS);
+		body[5 + 4*WCET_FIELDS] = 0;
+		append_sentence(&adversarial[i++], body, "%02X");
+		memcpy(body, "GPGGA", 5);
+		append_sentence(&adversarial[i++], body, "%02X");
+	}
+	// Starts and ends of nothing.
+	append_repeated(&adversarial[i], '$', 32);
+	append(&adversarial[i], "$GPGGA");
+	append_repeated(&adversarial[i], '$', 32);
+	append(&adversarial[i], "$GPZDA,120000.00,17,10,2026,00,00");
+	append(&adversarial[i++], "\r\n\r\r\r\n\n\n\r$\r$\n$*\r");
+
+	memset(&idle, 0, sizeof(idle));
+	for (r=0; r<WCET_ROUNDS; ++r) {
+		time_copy(&idle, &copy_seconds);
+		for (i=0; i<nnormal; ++i) {
+			time_stream(&normal[i]);
+		}
+		for (i=0; i<nadversarial; ++i) {
+			time_stream(&adversarial[i]);
+		}
+	}
+	worst_normal = report("normal traffic", normal, nnormal, copy_seconds);
+	worst_adversarial = report("adversarial input", adversarial, nadversarial, copy_seconds);
+
+	printf("worst call: normal %.1f ns, adversarial %.1f ns, ratio %.2f, budget %.2f\n",
+		worst_normal, worst_adversarial, worst_adversarial / worst_normal, budget);
+	if (worst_adversarial > budget * worst_normal) {
+		printf("FAIL: adversarial input over budget\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -3,7 +3,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>	// strlen
-#include <math.h>	// sin,cos.
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
@@ -14,69 +13,419 @@
 #include "main.h"
 #include "gps.h"
 #include "setup.h"	// setup channel.
-
-#define	HEADING_FIX	0
+#include "trig.h"
+#include "profile.h"
 
 #define TMR0_PRESC	256ul
 #define TMR0_RELOAD	(0ul - (F_CPU / (PRECISION_TICKS_PER_SECOND * TMR0_PRESC)))
 
 #define	PORTC_PULSE_MASK	0x0F
 
-
-/** Set up timer 1 (16-bit), frequency = F_CPU/(timertop+1). */
-#define setup_timer1(timertop) do {					\
-	OCR1A  = (timertop);	/* set top */				\
-	/*  Mode 4 - CTC with Prescaler 1 */				\
-	TCCR1B = (1<<WGM12)|(1<<CS10);					\
+/** Hardware PPS on the Timer1 compare outputs: OC1B (PB6) positive, OC1C (PB7) negative.
+ * While an edge is armed the compare unit switches the pins, otherwise PORTB holds the level. */
+#define	PPS_TCCR1A_ON	(_BV(COM1B1) | _BV(COM1B0) | _BV(COM1C1))
+#define	PPS_TCCR1A_OFF	(_BV(COM1B1) | _BV(COM1C1) | _BV(COM1C0))
+#define	PPS_PORTB_MASK	(_BV(PB6) | _BV(PB7))
+#define	PPS_PORTB_ON	_BV(PB6)
+#define	PPS_PORTB_OFF	_BV(PB7)
+/** PPS edges closer than this many Timer1 counts when the compare unit is written are switched in
+ * software, it may miss them. 128 CPU cycles, more than pps_arm_isr takes from its read of the count
+ * to the writes. */
+#define	PPS_MARGIN		16
+
+/** GGA position units (0.00001 arcminutes) per meter, 1/0.01852. */
+#define	POSITION_UNITS_PER_METER	54
+/** Position jumps this large restart the GGA heading baseline, about 2.4km. */
+#define	POSITION_DELTA_MAX		131072L
+
+/** Offsets into course_buffer. */
+#define	COURSE_BUFFER_DIGITS	7
+#define	COURSE_BUFFER_CHECKSUM	13
+#define	COURSE_BUFFER_LENGTH	17
+
+/** Timer1 runs free at F_CPU/8, extended to 32 bits by counting overflows. */
+#define	TIMER1_HZ		(F_CPU / 8)
+/** Timer1 counts per tick, nominal. */
+#define	TIMER1_COUNTS_PER_TICK	(TIMER1_HZ / PRECISION_TICKS_PER_SECOND)
+/** Frequency loop gains for each count of offset. Proportional: 1/256 counts per second, 15.6ppm per ms.
+ * Integral: 1/65536 counts per second for each second since the last time sentence, 0.5ppm per ms each second. */
+#define	TIMER1_KP		4
+#define	TIMER1_KI		32
+/** The integral gain counts at most this long since the last time sentence, milliseconds. A sentence
+ * after a gap then does not kick the frequency term by the drift of the whole gap. */
+#define	TIMER1_KI_INTERVAL_MAX	1000
+/** Frequency adjustment limit, 250ppm, 1/256 counts per second. */
+#define	TIMER1_ADJUST_MAX	(TIMER1_HZ / 4000 * 256)
+/** Offsets up to this many counts (3ms) are steered, larger ones stepped by at most setup.offset_limit. */
+#define	TIMER1_STEER_COUNTS	(3 * TIMER1_COUNTS_PER_TICK)
+/** Offsets are saturated to this many ticks, about 35 minutes, to fit in counts. */
+#define	TIMER1_OFFSET_TICKS_MAX	2000000L
+
+
+/** Set up timer 1 (16-bit), free running. */
+#define setup_timer1() do {						\
+	/*  Mode 0 - normal with Prescaler 8 */				\
+	TCCR1A = 0;							\
+	TCCR1B = (1<<CS11);						\
 	TCNT1 = 0; /* reset counter */					\
-	TIMSK1 |= (1<<OCIE1A); /* enable output-compare int */		\
+	/* PPS outputs idle at OFF, both from PORTB and the compare latches */	\
+	PORTB = (PORTB & ~PPS_PORTB_MASK) | PPS_PORTB_OFF;		\
+	DDRB |= PPS_PORTB_MASK;						\
+	TCCR1A = PPS_TCCR1A_OFF;					\
+	TCCR1C = (1<<FOC1B)|(1<<FOC1C);					\
+	TCCR1A = 0;							\
+	/* heading slots on channel A */				\
+	TIMSK1 |= (1<<TOIE1)|(1<<OCIE1A); /* enable overflow and compare int */	\
 } while (0)
 
-/** Ticks of the day. */
-static volatile int32_t	ticksoftheday = 0;
+/** Runtime statistics, see STATS. */
+STATS			stats;
+/** Timer1 overflows, upper half of the extended count. */
+volatile uint16_t	timer1_overflows = 0;
+/** Timebase, seconds since 2000-01-01 00:00:00 UTC, at the anchor. */
+static volatile uint32_t	timebase_seconds = 0;
+/** Timebase anchor, Timer1 count at the start of timebase_seconds. */
+static volatile uint32_t	timebase_count = 0;
+/** Timebase anchor, 1/256 counts. */
+static volatile uint8_t		timebase_fraction = 0;
 /** Is it valid? */
-static volatile bool	ticksoftheday_valid = false;
-/** Is it time to send the heading? */
+static volatile bool	timebase_valid = false;
+/** Timer1 counts per second, x256. */
+static volatile uint32_t	timer1_second_x256 = TIMER1_HZ * 256ul;
+/** Frequency error estimate, integral term of the adjustment, 1/65536 counts per second. */
+static int32_t		timer1_frequency = 0;
+/** Arrival of the last time sentence used, Timer1 count. */
+static uint32_t		timer1_updated = 0;
+/** Next PPS edge, Timer1 count. */
+static volatile uint32_t	pps_edge = 0;
+/** Level after pps_edge. */
+static volatile bool	pps_edge_on = false;
+/** Is pps_edge in the compare unit? */
+static volatile bool	pps_armed = false;
+/** Heading slot passed, time to insert it into the GPS stream on UART1. */
 static volatile bool	should_send_heading = false;
 
-static SETUP		setup = { /*pulse_length=*/100, /*pulse_offset=*/0 };
+static SETUP		setup = { .version = SETUP_VERSION, .pulse_length = 100, .pulse_offset = 0 };
+
+/** GPS receiver, 0=primary on UART0, 1=secondary on UART3. */
+typedef struct {
+	GPS_PARSER	parser;
+	/** Arrival of the last '$'. */
+	TIMESTAMP	start;
+	/** Previous offset, Timer1 counts, for the two-sample average. */
+	int32_t		last_offset;
+	/** Arrival of the last valid time sentence. */
+	EPOCH_TIME	time_received;
+	/** Has delivered a valid time sentence. */
+	bool		has_time;
+	/** Start of the GGA heading baseline. */
+	bool		has_reference;
+	int32_t		reference_latitude;
+	int32_t		reference_longitude;
+} RECEIVER;
+
+#define	NUMBER_OF_RECEIVERS	2
+
+static RECEIVER		receivers[NUMBER_OF_RECEIVERS];
+/** Receiver used for time and course. */
+static uint8_t		active_receiver = 0;
+
+/** HDG sentence for the compass, "$HDHDT,ddd,T*hh\r\n". Empty until the first course. */
+static char			course_buffer[COURSE_BUFFER_LENGTH + 1] = { 0 };
+/** XOR of course_buffer between '$' and '*'. */
+static uint8_t		course_checksum = 0;
+
+/** Filtered course, x16384. */
+static int16_t		cos_x14 = 0;
+static int16_t		sin_x14 = 0;
 
 /*****************************************************/
-// Cannot use ISR_NOBLOCK, because it takes too much time.
-ISR (TIMER1_COMPA_vect)
-{	
-	static uint16_t	heading_ticks = 0;
-	static int32_t	lticks;
-	
-	PORTC |= 0x80;
+/** Extended Timer1 count. Interrupts must be disabled. */
+static uint32_t
+timer1_count_isr()
+{
+	TIMESTAMP	ts;
+	gettimestamp_isr(ts);
+	return ts.count;
+}
+
+/*****************************************************/
+/** Timer1 counts in \c ticks, up to 4000 ticks. */
+static uint32_t
+counts_of_ticks(	const uint16_t		ticks)
+{
+	return (uint32_t)ticks * (timer1_second_x256 >> 8) / PRECISION_TICKS_PER_SECOND;
+}
+
+/*****************************************************/
+/** Move the timebase anchor over the seconds passed by Timer1 count \c now. Interrupts must be disabled. */
+static void
+timebase_advance_isr(	const uint32_t		now)
+{
+	const uint32_t	second_x256 = timer1_second_x256;
 
-	// 1. Increment ticks of the day.
-	if (++ticksoftheday >= PRECISION_TICKS_PER_DAY) {
-		ticksoftheday = 0;
+	while ((int32_t)(now - timebase_count) >= (int32_t)(second_x256 >> 8)) {
+		const uint16_t	fraction = timebase_fraction + (uint8_t)second_x256;
+		timebase_count += (second_x256 >> 8) + (fraction >> 8);
+		timebase_fraction = fraction;
+		++timebase_seconds;
 	}
-	lticks = ticksoftheday;
+}
 
-	// 2. Blink leds, if possible.
-	if (ticksoftheday_valid) {
-		const int16_t	smalltick = (lticks + PRECISION_TICKS_PER_DAY + setup.pulse_offset) % PRECISION_TICKS_PER_SECOND;
-		if (smalltick < setup.pulse_length) {
-			// ON
-			PORTC = (PORTC & ~PORTC_PULSE_MASK) | 0x03;
-		} else {
-			// OFF
-			PORTC = (PORTC & ~PORTC_PULSE_MASK) | 0x0C;
+/*****************************************************/
+/** Time of Timer1 count \c count, at most a few seconds from the anchor, down to the tick.
+ * The counts past the tick go to \c remainder, unless NULL. */
+static void
+epoch_of_count(		EPOCH_TIME*			t,
+					const uint32_t		count,
+					uint16_t*			remainder)
+{
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	uint32_t	second;
+	int32_t		counts;
+	uint32_t	scaled;
+
+	// Copy the anchor, divide with interrupts enabled.
+	cli();
+	second = timer1_second_x256 >> 8;
+	counts = count - timebase_count;
+	t->seconds = timebase_seconds;
+	if (interrupts_enabled) {
+		sei();
+	}
+
+	t->ticks = 0;
+	while (counts < 0) {
+		counts += second;
+		--t->seconds;
+	}
+	scaled = (uint32_t)counts * PRECISION_TICKS_PER_SECOND;
+	epoch_add(t, scaled / second);
+	if (remainder != NULL) {
+		*remainder = scaled % second / PRECISION_TICKS_PER_SECOND;
+	}
+}
+
+/*****************************************************/
+/** Drive the PPS outputs and LEDs to the given level in software.
+ * The compare latches are forced to it too, they take over the pins when an edge is armed. */
+static void
+pps_set_level_isr(	const bool			on)
+{
+	if (on) {
+		PORTB = (PORTB & ~PPS_PORTB_MASK) | PPS_PORTB_ON;
+		PORTC = (PORTC & ~PORTC_PULSE_MASK) | 0x03;
+		TCCR1A = PPS_TCCR1A_ON;
+	} else {
+		PORTB = (PORTB & ~PPS_PORTB_MASK) | PPS_PORTB_OFF;
+		PORTC = (PORTC & ~PORTC_PULSE_MASK) | 0x0C;
+		TCCR1A = PPS_TCCR1A_OFF;
+	}
+	TCCR1C = (1<<FOC1B)|(1<<FOC1C);
+	TCCR1A = 0;
+}
+
+/*****************************************************/
+/** Hand pps_edge to the compare unit once it is less than a Timer1 wrap away. Within two wraps,
+ * the compare match one wrap before the edge does it. Further away, the compare interrupt stays off,
+ * so it does not fire on every wrap; the overflow interrupt calls again.
+ * Returns false when the edge is closer than PPS_MARGIN or passed, it is then switched in software:
+ * plan the PPS again. */
+static bool
+pps_arm_isr(void)
+{
+	uint32_t	distance = pps_edge - timer1_count_isr();
+
+	if ((int32_t)distance >= PPS_MARGIN) {
+		OCR1B = (uint16_t)pps_edge;
+		OCR1C = (uint16_t)pps_edge;
+		pps_armed = distance < 0x10000ul;
+		TCCR1A = !pps_armed ? 0 : pps_edge_on ? PPS_TCCR1A_ON : PPS_TCCR1A_OFF;
+		if (distance >= 0x20000ul) {
+			return true;
+		}
+		// The count after the writes: was the compare unit in time?
+		distance = pps_edge - timer1_count_isr();
+	}
+	if ((int32_t)distance < PPS_MARGIN) {
+		pps_set_level_isr(pps_edge_on);
+		pps_armed = false;
+		return false;
+	}
+	if (distance < 0x10000ul && !pps_armed) {
+		// The match one wrap early passed meanwhile.
+		TCCR1A = pps_edge_on ? PPS_TCCR1A_ON : PPS_TCCR1A_OFF;
+		pps_armed = true;
+	}
+	TIFR1 = _BV(OCF1B);
+	TIMSK1 |= _BV(OCIE1B);
+	return true;
+}
+
+/*****************************************************/
+/** Plan the PPS from the timebase: set the current level and the next edge. Interrupts must be disabled. */
+static void
+pps_schedule_isr(void)
+{
+	TIMSK1 &= ~_BV(OCIE1B);
+
+	if (timebase_valid) {
+		const uint32_t	second = timer1_second_x256 >> 8;
+		const uint16_t	rise_ticks = (PRECISION_TICKS_PER_SECOND - setup.pulse_offset) % PRECISION_TICKS_PER_SECOND;
+		const uint32_t	rise = timebase_count + counts_of_ticks(rise_ticks);
+		const uint32_t	fall = timebase_count + counts_of_ticks(rise_ticks + setup.pulse_length);
+
+		do {
+			// The count after the divisions above. Edges closer than PPS_MARGIN are taken now.
+			const uint32_t	now = timer1_count_isr() + PPS_MARGIN;
+			bool			on;
+
+			if ((int32_t)(now - (rise - second)) >= 0 && (int32_t)(now - (fall - second)) < 0) {
+				// Pulse of the previous second.
+				on = true;
+				pps_edge = fall - second;
+			} else if ((int32_t)(now - rise) < 0) {
+				on = false;
+				pps_edge = rise;
+			} else if ((int32_t)(now - fall) < 0) {
+				on = true;
+				pps_edge = fall;
+			} else {
+				on = false;
+				pps_edge = rise + second;
+			}
+			// An armed edge may switch the pins any time until pps_arm_isr. Force a level only
+			// when it changes from PORTB, which is where that edge goes.
+			if (on != ((PORTB & PPS_PORTB_MASK) == PPS_PORTB_ON)) {
+				pps_set_level_isr(on);
+			}
+			pps_edge_on = !on;
+		} while (!pps_arm_isr());
+	} else {
+		TCCR1A = 0;
+		pps_armed = false;
+		PORTB = (PORTB & ~PPS_PORTB_MASK) | PPS_PORTB_OFF;
+	}
+}
+
+/*****************************************************/
+/** Heading slot: start the HDG sentence on UART2 now, independent of GPS traffic. */
+ISR (TIMER1_COMPA_vect)
+{
+	PROFILE_ISR_BEGIN();
+	static uint32_t	heading_count = 0;
+	static uint32_t	heading_period = 0;
+	static int16_t	heading_rate = 0;
+	const uint32_t	now = timer1_count_isr();
+
+	// Slots longer than a Timer1 wrap also match early.
+	if ((int32_t)(now - heading_count) >= 0) {
+		if (heading_rate != setup.heading_rate) {
+			heading_rate = setup.heading_rate;
+			heading_period = TIMER1_HZ / (heading_rate>0 ? heading_rate : HEADINGS_PER_SECOND);
+		}
+		heading_count += heading_period;
+		if ((int32_t)(now - heading_count) >= 0) {
+			// Fell behind, start again from now.
+			heading_count = now + heading_period;
+		}
+		OCR1A = (uint16_t)heading_count;
+
+		if (course_buffer[0] != 0) {
+			uart2_WriteIsr((const uint8_t*)course_buffer, COURSE_BUFFER_LENGTH);
+			should_send_heading = true;
 		}
 	}
+	PROFILE_ISR_END(PROFILE_TIMER1_COMPA);
+}
+
+/*****************************************************/
+/** Timer1 wrapped, every 65536 counts. */
+ISR (TIMER1_OVF_vect)
+{
+	PROFILE_ISR_BEGIN();
+	uint32_t	now;
+
+	++timer1_overflows;
+	now = ((uint32_t)timer1_overflows << 16) | TCNT1;
+	timebase_advance_isr(now);
+	// Hand the next edge to the compare unit once it is within two wraps.
+	if (timebase_valid && (TIMSK1 & _BV(OCIE1B)) == 0 && !pps_arm_isr()) {
+		pps_schedule_isr();
+	}
+	PROFILE_ISR_END(PROFILE_TIMER1_OVF);
+}
+
+/*****************************************************/
+/** Compare match on the PPS channels: either the armed edge, or one wrap before it. */
+ISR (TIMER1_COMPB_vect)
+{
+	PROFILE_ISR_BEGIN();
+	const uint32_t	now = timer1_count_isr();
+
+	PORTC |= 0x80;
 
-	// 3. Signal heading, if possible.
-	if (++heading_ticks > PRECISION_TICKS_PER_HEADING) {
-		heading_ticks = 0;
-		should_send_heading = true;
+	if (pps_armed) {
+		// The compare unit has switched the pins, hold the level on PORTB.
+		pps_set_level_isr(pps_edge_on);
+		timebase_advance_isr(now);
+		pps_schedule_isr();
+	} else if (!pps_arm_isr()) {
+		// The match one wrap early was missed, the edge was switched in software.
+		timebase_advance_isr(now);
+		pps_schedule_isr();
 	}
 
 	PORTC &= ~0x80;
+	PROFILE_ISR_END(PROFILE_TIMER1_COMPB);
+}
+
+
+#if defined(__AVR__)
+/*****************************************************************************/
+/** Fill the RAM from the end of the static data to the stack top with STACK_CANARY.
+ * Runs from .init1, before the stack pointer is set up: no calls, no C.
+ */
+void stack_paint(void) __attribute__ ((naked, used, section (".init1")));
+void
+stack_paint(void)
+{
+	__asm__ __volatile__ (
+		"	ldi r30, lo8(_end)\n"
+		"	ldi r31, hi8(_end)\n"
+		"	ldi r24, %0\n"
+		"	ldi r25, hi8(__stack)\n"
+		"	rjmp 2f\n"
+		"1:	st Z+, r24\n"
+		"2:	cpi r30, lo8(__stack)\n"
+		"	cpc r31, r25\n"
+		"	brlo 1b\n"
+		"	breq 1b\n"
+		: : "M" (STACK_CANARY));
 }
 
+/*****************************************************************************/
+uint16_t
+stack_unused(void)
+{
+	extern uint8_t	_end;
+	extern uint8_t	__stack;
+	const uint8_t*	p = &_end;
+
+	while (p <= &__stack && *p == STACK_CANARY) {
+		++p;
+	}
+	return p - &_end;
+}
+#else
+/*****************************************************************************/
+/** Host builds (host/) have no painted stack. */
+uint16_t
+stack_unused(void)
+{
+	return 0;
+}
+#endif
 
 /*****************************************************/
 void io_Init(void)
@@ -114,37 +463,86 @@ void io_Init(void)
 	PORTL = 0;
 	DDRL = 0;
 
-	setup_timer1(F_CPU / 1000);
+	setup_timer1();
+}
+
+/*****************************************************************************/
+void
+epoch_add(			EPOCH_TIME*			t,
+					const int32_t		extra_ticks)
+{
+	int32_t	ticks = t->ticks + extra_ticks;
+	int32_t	seconds = ticks / PRECISION_TICKS_PER_SECOND;
+
+	ticks -= seconds * PRECISION_TICKS_PER_SECOND;
+	if (ticks < 0) {
+		ticks += PRECISION_TICKS_PER_SECOND;
+		--seconds;
+	}
+	t->seconds += seconds;
+	t->ticks = ticks;
 }
 
 /*****************************************************************************/
 int32_t
-getticksoftheday()
+epoch_difference(	const EPOCH_TIME*	a,
+					const EPOCH_TIME*	b)
+{
+	const int32_t	seconds = a->seconds - b->seconds;
+	if (seconds > 2000000L) {
+		return 2000000L * PRECISION_TICKS_PER_SECOND;
+	} else if (seconds < -2000000L) {
+		return -2000000L * PRECISION_TICKS_PER_SECOND;
+	}
+	return seconds * PRECISION_TICKS_PER_SECOND + ((int16_t)a->ticks - (int16_t)b->ticks);
+}
+
+/*****************************************************************************/
+/** Extended Timer1 count. */
+static uint32_t
+timer1_count()
 {
-	const bool	interrupts_enabled = (SREG & 0x80) == 0;
-	int32_t	r;
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	uint32_t	now;
+	cli();
+	now = timer1_count_isr();
 	if (interrupts_enabled) {
-		cli();
-		r = ticksoftheday;
 		sei();
-		return r;
 	}
-	return ticksoftheday;
+	return now;
 }
 
 /*****************************************************************************/
 void
-addticksoftheday(	const int32_t		extra_ticks)
+gettimebase(		EPOCH_TIME*		t)
+{
+	epoch_of_count(t, timer1_count(), NULL);
+}
+
+/*****************************************************************************/
+void
+addtimebase(		const int32_t		extra_ticks)
 {
 	// Are we allowed to add?
-	if (ticksoftheday_valid && extra_ticks!=0) {
-		const bool	interrupts_enabled = (SREG & 0x80) == 0;
-		if (interrupts_enabled) {
-			cli();
+	if (timebase_valid && extra_ticks!=0) {
+		const bool	interrupts_enabled = (SREG & 0x80) != 0;
+		int32_t		seconds = extra_ticks / PRECISION_TICKS_PER_SECOND;
+		int16_t		ticks = extra_ticks - seconds * PRECISION_TICKS_PER_SECOND;
+		uint32_t	now;
+
+		if (ticks < 0) {
+			ticks += PRECISION_TICKS_PER_SECOND;
+			--seconds;
 		}
 
-		ticksoftheday = (ticksoftheday + extra_ticks + PRECISION_TICKS_PER_DAY) % PRECISION_TICKS_PER_DAY;
-		ticksoftheday_valid = ticksoftheday >= 0;
+		cli();
+
+		// Later time is an earlier anchor.
+		now = timer1_count_isr();
+		timebase_seconds += seconds;
+		timebase_count -= counts_of_ticks(ticks);
+		timebase_advance_isr(now);
+		pps_schedule_isr();
 
 		if (interrupts_enabled) {
 			sei();
@@ -153,17 +551,59 @@ addticksoftheday(	const int32_t		extra_ticks)
 }
 
 /*****************************************************************************/
-void setticksoftheday(	const int32_t		ticks)
+void
+settimebase(		const EPOCH_TIME*	t)
 {
-	const bool	interrupts_enabled = (SREG & 0x80) == 0;
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	uint32_t	now;
+
+	cli();
+
+	now = timer1_count_isr();
+	timebase_seconds = t->seconds;
+	timebase_count = now - counts_of_ticks(t->ticks);
+	timebase_fraction = 0;
+	timebase_valid = true;
+	pps_schedule_isr();
 
 	if (interrupts_enabled) {
-		cli();
+		sei();
 	}
+}
 
-	ticksoftheday = (ticks + PRECISION_TICKS_PER_DAY) % PRECISION_TICKS_PER_DAY;
-	ticksoftheday_valid = ticksoftheday >= 0;
+/*****************************************************************************/
+/** Steer the length of the second by the remaining offset, PI loop. Positive offset means the timebase is late.
+ * \c offset is in Timer1 counts, at most TIMER1_STEER_COUNTS, and \c interval the milliseconds since the last
+ * time sentence, at most TIMER1_KI_INTERVAL_MAX. */
+static void
+steer_timebase(		const int32_t		offset,
+					const int16_t		interval)
+{
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	int32_t		adjust;
+	uint32_t	now;
+
+	// The integral grows with the time the offset stood, whatever the sentence rate.
+	timer1_frequency -= offset * interval * TIMER1_KI / 1000;
+	if (timer1_frequency > TIMER1_ADJUST_MAX * 256L) {
+		timer1_frequency = TIMER1_ADJUST_MAX * 256L;
+	} else if (timer1_frequency < -TIMER1_ADJUST_MAX * 256L) {
+		timer1_frequency = -TIMER1_ADJUST_MAX * 256L;
+	}
 
+	// The proportional term is a rate, held until the next sentence: it corrects more over a longer interval by itself.
+	adjust = (timer1_frequency >> 8) - offset * TIMER1_KP;
+	if (adjust > TIMER1_ADJUST_MAX) {
+		adjust = TIMER1_ADJUST_MAX;
+	} else if (adjust < -TIMER1_ADJUST_MAX) {
+		adjust = -TIMER1_ADJUST_MAX;
+	}
+
+	cli();
+	now = timer1_count_isr();
+	timer1_second_x256 = TIMER1_HZ * 256ul + adjust;
+	timebase_advance_isr(now);
+	pps_schedule_isr();
 	if (interrupts_enabled) {
 		sei();
 	}
@@ -171,189 +611,390 @@ void setticksoftheday(	const int32_t		ticks)
 
 /*****************************************************************************/
 bool
-is_ticksoftheday_valid()
+is_timebase_valid()
 {
-	return ticksoftheday_valid;
+	return timebase_valid;
 }
 
 /*****************************************************************************/
+/** Offset of the timebase against time \c t, current at Timer1 count \c count. Timer1 counts,
+ * positive when the timebase is late, saturated to TIMER1_OFFSET_TICKS_MAX. */
+static int32_t
+timebase_offset(	const EPOCH_TIME*	t,
+					const uint32_t		count)
+{
+	EPOCH_TIME	arrival;
+	uint16_t	counts;
+	int32_t		ticks;
+
+	epoch_of_count(&arrival, count, &counts);
+	ticks = epoch_difference(t, &arrival);
+	if (ticks > TIMER1_OFFSET_TICKS_MAX) {
+		ticks = TIMER1_OFFSET_TICKS_MAX;
+	} else if (ticks < -TIMER1_OFFSET_TICKS_MAX) {
+		ticks = -TIMER1_OFFSET_TICKS_MAX;
+	}
+	return ticks * TIMER1_COUNTS_PER_TICK - counts;
+}
+
 /*****************************************************************************/
-int
-main(void)
+/** Time from receiver \c rx arrived: fail over if needed and steer the timebase.
+ * Undated GGA time is placed on the day nearest to the timebase. */
+static void
+handle_gps_time(	const uint8_t		rx,
+					const SENTENCE		sentence,
+					const EPOCH_TIME*	gps_time)
 {
-	char		xbuf[64];
+	RECEIVER*	receiver = &receivers[rx];
+	EPOCH_TIME	now;
+	EPOCH_TIME	t = *gps_time;
+	int32_t		new_offset;
+
+	gettimebase(&now);
+	if (sentence == SENTENCE_GGA) {
+		t.seconds += now.seconds - now.seconds % SECONDS_PER_DAY;
+		if (t.seconds > now.seconds + SECONDS_PER_DAY/2) {
+			t.seconds -= SECONDS_PER_DAY;
+		} else if (t.seconds + SECONDS_PER_DAY/2 < now.seconds) {
+			t.seconds += SECONDS_PER_DAY;
+		}
+	}
+	new_offset = timebase_offset(&t, receiver->start.count);
+
+	receiver->time_received = now;
+	receiver->has_time = true;
+
+	// Primary always wins, secondary takes over when the active one is silent.
+	if (rx != active_receiver) {
+		const RECEIVER*	active = &receivers[active_receiver];
+		const int32_t	silence = epoch_difference(&now, &active->time_received);
+		if (rx < active_receiver || !active->has_time || silence >= PRECISION_TICKS_FAILOVER) {
+			active_receiver = rx;
+			receiver->last_offset = new_offset;
+			setup_send_nowait_P(rx==0 ? PSTR("\r\nPrimary GPS active.\r\n") : PSTR("\r\nSecondary GPS active.\r\n"));
+		}
+	}
 
-	char		course_buffer[64] = { 0 };
-#if (HEADING_FIX)
-	// course is buffered for output on UART2.
-	uint8_t		course_buffer_length = 0;
-	uint8_t		course_to_do = 0;
-	uint8_t		course_so_far = 0;
-	uint8_t		course_sparse = 0;
-#endif
+	if (rx != active_receiver) {
+		// Standby: keep the offset history warm.
+		receiver->last_offset = new_offset;
+		return;
+	}
 
-	uint8_t 	ch;
-	uint16_t	vtg_course_x100 = 0;
-	int32_t		gps_ticks;
-	int32_t		gps_start_ticks = 0;
-	int32_t		last_offset = 0;
+	// signal!
+	PORTC = PORTC ^ 0x40;
+
+	if (is_timebase_valid()) {
+		// Counts, halved first, the offsets may be saturated.
+		const int32_t	ofs = receiver->last_offset / 2 + new_offset / 2;
+		const int32_t	ofs_ticks = (ofs + (ofs < 0 ? -TIMER1_COUNTS_PER_TICK/2 : TIMER1_COUNTS_PER_TICK/2)) / TIMER1_COUNTS_PER_TICK;
+		const uint32_t	interval = (receiver->start.count - timer1_updated) / TIMER1_COUNTS_PER_TICK;
+		int32_t		step = 0;
+
+		// Jumps are stepped whole, other offsets beyond the steering range by up to offset_limit.
+		// Steps are not steered, they would wind the frequency term up.
+		if (ofs_ticks >= setup.jump_limit || -ofs_ticks >= setup.jump_limit) {
+			step = ofs_ticks;
+			++stats.time_jumps;
+		} else if (ofs > TIMER1_STEER_COUNTS || -ofs > TIMER1_STEER_COUNTS) {
+			step = ofs_ticks;
+			if (step > setup.offset_limit) {
+				step = setup.offset_limit;
+			} else if (-setup.offset_limit > step) {
+				step = -setup.offset_limit;
+			}
+			++stats.time_steps;
+		}
+		receiver->last_offset = new_offset - step * TIMER1_COUNTS_PER_TICK;
+		if (step != 0) {
+			addtimebase(step);
+		} else {
+			steer_timebase(ofs, interval < TIMER1_KI_INTERVAL_MAX ? interval : TIMER1_KI_INTERVAL_MAX);
+		}
+		timer1_updated = receiver->start.count;
+		if (setup.realtime_show) {
+			char	xbuf[40];
+			// Counts are microseconds. 1/65536 counts per second to ppb.
+			sprintf_P(xbuf, PSTR("ofs=%ldus frq=%ldppb\r\n"), ofs, -((timer1_frequency >> 8) * (1000000000L / TIMER1_HZ)) / 256);
+			// Skip the line rather than wait for a busy console.
+			uart2_WriteAll((const uint8_t*)xbuf, strlen(xbuf));
+		}
+	} else {
+		setup_send_nowait_P(PSTR("\r\nFirst tick!\r\n"));
+		epoch_add(&t, (timer1_count() - receiver->start.count) / TIMER1_COUNTS_PER_TICK);
+		settimebase(&t);
+		receiver->last_offset = 0;
+		timer1_updated = receiver->start.count;
+	}
+}
 
-	int16_t		cos_x14 = 0;	// x16384
-	int16_t		sin_x14 = 0;	// x16384
+/*****************************************************************************/
+static uint8_t
+hexchar_of_int(		const uint8_t	ii)
+{
+	return ii<10 ? ii + '0' : ii + 'A' - 10;
+}
 
-	io_Init();
-	uart_Init();
-	
-	sei();
+/*****************************************************************************/
+/** Rebuild course_buffer for the current compass sentence, heading 000. Interrupts must be disabled. */
+static void
+course_buffer_init_isr()
+{
+	uint8_t		i;
 
-	setup_send_P(PSTR("\r\nWelcome to GPS BLESSER v1.0!\r\n"));
-	setup_load_from_nvram(&setup);
-	setup_send_P(PSTR("\r\n>"));
+	course_buffer[0] = '$';
+	memcpy(course_buffer + 1, setup.compass_sentence, 5);
+	memcpy_P(course_buffer + 6, PSTR(",000,T*00\r\n"), COURSE_BUFFER_LENGTH - 6);
+	course_buffer[COURSE_BUFFER_LENGTH] = 0;
 
-	for (;;) {
-		// UART0: Data From GPS
-		if (!uart0_IsRxEmpty())
-		{
-			ch = uart0_GetChar();
+	course_checksum = 0;
+	for (i=1; i<COURSE_BUFFER_CHECKSUM - 1; ++i) {
+		course_checksum ^= course_buffer[i];
+	}
+}
 
-			// and handle it!
-			if (ch == '$') {
-				gps_start_ticks = getticksoftheday();
-				PORTC = PORTC ^ 0x10;
-			}
+/*****************************************************************************/
+/** Patch the heading digits of course_buffer, and the checksum from the old and new digits.
+ * Rebuilds it first when empty, or when the compass sentence changed on the setup channel. */
+static void
+course_buffer_set(	const uint16_t		degrees)
+{
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	char*		digits = course_buffer + COURSE_BUFFER_DIGITS;
+	const char	d0 = '0' + degrees / 100;
+	const char	d1 = '0' + (degrees / 10) % 10;
+	const char	d2 = '0' + degrees % 10;
+	uint8_t		checksum;
+
+	// The heading ISR sends course_buffer, it never sees the 000 of a rebuild.
+	cli();
+	if (course_buffer[0]==0 || memcmp(course_buffer + 1, setup.compass_sentence, 5)!=0) {
+		course_buffer_init_isr();
+	}
+	checksum = course_checksum ^ digits[0] ^ digits[1] ^ digits[2] ^ d0 ^ d1 ^ d2;
+	digits[0] = d0;
+	digits[1] = d1;
+	digits[2] = d2;
+	course_buffer[COURSE_BUFFER_CHECKSUM] = hexchar_of_int(checksum >> 4);
+	course_buffer[COURSE_BUFFER_CHECKSUM + 1] = hexchar_of_int(checksum & 0x0F);
+	course_checksum = checksum;
+	if (interrupts_enabled) {
+		sei();
+	}
+}
 
-			// echo back :)
-			uart0_PutChar(ch);
-			uart1_PutChar(ch);
-
-			switch (handle_gps_input(ch, &gps_ticks, &vtg_course_x100)) {
-				case SENTENCE_GGA:	/* passthrough. */
-				case SENTENCE_ZDA:
-					// signal!
-					PORTC = PORTC ^ 0x40;
-
-					if (is_ticksoftheday_valid()) {
-						int32_t	new_offset = (gps_ticks - gps_start_ticks);
-						int32_t	ofs = (last_offset + new_offset) / 2;
-						if (ofs < setup.jump_limit && -ofs<setup.jump_limit) {
-							if (ofs > setup.offset_limit) {
-								ofs = setup.offset_limit;
-							} else if (-setup.offset_limit > ofs) {
-								ofs = -setup.offset_limit;
-							}
-						}
-						last_offset = new_offset;
-						if (ofs != 0) {
-							addticksoftheday(ofs);
-						}
-						if (setup.realtime_show) {
-							sprintf_P(xbuf, PSTR("ofs=%ld\r\n"), ofs);
-							setup_send(xbuf);
-						}
-					} else {
-						int32_t	ofs = getticksoftheday() - gps_start_ticks;
-						setup_send_P(PSTR("\r\nFirst tick!\r\n"));
-						setticksoftheday(gps_ticks + ofs);
-					}
-					break;
-				case SENTENCE_VTG:
-					{
-					// Course update!
-					const float	vtg_course = (0.01 * 3.14159265358979323844 / 180.0) * vtg_course_x100;
-					const int16_t	icos = 16384 * cos(vtg_course);
-					const int16_t	isin = 16384 * sin(vtg_course);
-					const int32_t	f2 = 100 - setup.reaction_speed;
-					
-
-					if (setup.realtime_show) {
-						// sprintf_P(xbuf, PSTR("course=%u\r\n"), vtg_course_x100);
-						setup_send(xbuf);
-					}
-
-					// 1. Update sliding buffer.
-					cos_x14 = (((int32_t)setup.reaction_speed)*icos + f2*cos_x14)/100;
-					sin_x14 = (((int32_t)setup.reaction_speed)*isin + f2*sin_x14)/100;
-
-					// 2. Calculate course2_x100.
-					int16_t c0 = (100.0 * 180.0 / 3.14159265358979323844) * atan2(sin_x14, cos_x14);
-					uint16_t	course2_x100 = c0>=0 ? c0 : (c0 + 36000u);
+/*****************************************************************************/
+/** Course from the active receiver arrived: update the filtered heading and course_buffer. */
+static void
+handle_gps_course(	const uint16_t		vtg_course_x100)
+{
+	const int16_t	icos = trig_cos_x14(vtg_course_x100);
+	const int16_t	isin = trig_sin_x14(vtg_course_x100);
+	const int32_t	f2 = 100 - setup.reaction_speed;
+	
+
+	// 1. Update sliding buffer.
+	cos_x14 = (((int32_t)setup.reaction_speed)*icos + f2*cos_x14)/100;
+	sin_x14 = (((int32_t)setup.reaction_speed)*isin + f2*sin_x14)/100;
+
+	// 2. Calculate course2_x100.
+	const uint16_t	course2_x100 = trig_atan2_x100(sin_x14, cos_x14);
 
 #if (0)
-					sprintf_P(xbuf, PSTR("course=%u course2=%u diff=%d cos_x14=%d sin_x14=%d\r\n"),
-						vtg_course_x100,
-						course2_x100, course2_x100 - vtg_course_x100,
-						cos_x14, sin_x14);
-					setup_send(xbuf);
+	sprintf_P(xbuf, PSTR("course=%u course2=%u diff=%d cos_x14=%d sin_x14=%d\r\n"),
+		vtg_course_x100,
+		course2_x100, course2_x100 - vtg_course_x100,
+		cos_x14, sin_x14);
+	setup_send(xbuf);
 #endif
-					// 3. Update course_buffer.
-					sprintf_P(course_buffer, PSTR("$%s,%03u,T*"), setup.compass_sentence, course2_x100/100);
-					uint8_t		checksum = 0;
-					uint8_t*	ptr = (uint8_t*)course_buffer + 1;
-					for (; *ptr!='*'; ++ptr) {
-						checksum = checksum ^ *ptr;
-					}
-					++ptr;
-					sprintf_P((char*)ptr, PSTR("%02X\r\n"), (unsigned int)checksum);
-#if (HEADING_FIX)
-					course_buffer_length = ((char*)ptr - course_buffer) + 4;
-#endif
-					}
-					break;
-				default:
-					// pass
-					break;
+	// 3. Update course_buffer.
+	course_buffer_set(course2_x100 / 100);
+}
+
+/*****************************************************************************/
+/** Position from the active receiver arrived: course over ground once it has moved setup.heading_baseline meters. */
+static void
+handle_gps_position(	RECEIVER*			receiver,
+						const GPS_DATA*		data)
+{
+	const int32_t	dlat = data->latitude - receiver->reference_latitude;
+	const int32_t	dlon = data->longitude - receiver->reference_longitude;
+
+	if (receiver->has_reference && labs(dlat)<POSITION_DELTA_MAX && labs(dlon)<POSITION_DELTA_MAX) {
+		// Flat earth over the baseline, longitude shrinks with cos(latitude).
+		const int32_t	baseline = (int32_t)setup.heading_baseline * POSITION_UNITS_PER_METER;
+		const int32_t	dnorth = dlat;
+		const int32_t	deast = (dlon * trig_cos_x14(labs(data->latitude) / 60000)) >> 14;
+
+		if (labs(dnorth)<baseline && labs(deast)<baseline && dnorth*dnorth + deast*deast<baseline*baseline) {
+			// Not far enough yet.
+			return;
+		}
+		handle_gps_course(trig_atan2_x100(deast, dnorth));
+	}
+	receiver->has_reference = true;
+	receiver->reference_latitude = data->latitude;
+	receiver->reference_longitude = data->longitude;
+}
+
+/*****************************************************************************/
+/** Dispatch a completed sentence from receiver \c rx. */
+static void
+handle_gps_sentence(	const uint8_t		rx,
+						const SENTENCE		sentence,
+						const GPS_DATA*		data)
+{
+	switch (sentence) {
+		case SENTENCE_GGA:	/* passthrough. */
+		case SENTENCE_ZDA:
+			if (data->has_time) {
+				handle_gps_time(rx, sentence, &data->time);
 			}
+			if (data->has_position && active_receiver==rx && setup.heading_source==HEADING_SOURCE_GGA) {
+				handle_gps_position(&receivers[rx], data);
+			}
+			break;
+		case SENTENCE_VTG:
+			if (active_receiver==rx && setup.heading_source==HEADING_SOURCE_VTG) {
+				handle_gps_course(data->course_x100);
+			}
+			break;
+		default:
+			// pass
+			break;
+	}
+}
 
-			// Add extra fresh course buffer, if necessary.
-			if (should_send_heading && course_buffer[0]!=0 && ch==0x0A) {
-				const char*	ptr = course_buffer;
-				should_send_heading = false;
-#if (HEADING_FIX)
-				if (course_so_far >= course_to_do) {
-					course_to_do  = course_buffer_length;
-					course_so_far = 0;
-				}
-#endif
-				for (; *ptr!=0; ++ptr) {
-					uart1_PutChar(*ptr);
-#if (!HEADING_FIX)
-					uart2_PutChar(*ptr);
+/*****************************************************************************/
+#if (UART1_TX_OVERFLOW != UART_OVERFLOW_SENTENCE)
+#error The heading insertion on UART1 relies on UART_OVERFLOW_SENTENCE.
 #endif
+
+/*****************************************************************************/
+/** Add the fresh heading to the GPS stream on UART1, never inside a GPS sentence.
+ * UART1 queues whole sentences, so it waits at most for the end of the one being echoed.
+ */
+static void
+send_heading_between_sentences(void)
+{
+	if (should_send_heading && !uart1_IsTxInSentence()) {
+		should_send_heading = false;
+		uart1_Write((const uint8_t*)course_buffer, COURSE_BUFFER_LENGTH);
+	}
+}
+
+/*****************************************************************************/
+/** One pass of the main loop: the receivers, the outputs and the setup channel. */
+static void
+handle_uarts(void)
+{
+	uint8_t 	ch;
+	GPS_DATA	gps_data;
+
+	PROFILE_BEGIN(loop_start);
+
+	// UART0: Data From GPS
+	if (!uart0_IsRxEmpty())
+	{
+		RECEIVER*		receiver = &receivers[0];
+		const uint8_t*	span;
+		const uint16_t	span_length = uart0_PeekRx(&span);
+		uint16_t		span_done = 0;
+
+		while (span_done < span_length) {
+			// handle it, up to the next '$', CR or LF.
+			SENTENCE		sentence;
+			const uint8_t*	chunk = span + span_done;
+			PROFILE_BEGIN(parse_start);
+			const uint16_t	chunk_length = handle_gps_span(&receiver->parser, chunk, span_length - span_done, &sentence, &gps_data);
+			PROFILE_END(parse_start, PROFILE_GPS_NONE + sentence);
+
+			span_done += chunk_length;
+			ch = chunk[chunk_length - 1];
+
+			// echo back :)
+			uart0_Write(chunk, chunk_length);
+			uart1_Write(chunk, chunk_length);
+
+			if (ch == '$') {
+				// Arrival time from the RX interrupt, if available.
+				if (!uart0_GetStamp(chunk + chunk_length - 1, &receiver->start)) {
+					receiver->start.count = timer1_count();
 				}
-			} else {
-#if (HEADING_FIX)
-				++course_sparse;
-				if ((course_sparse & 0x03)==0 && course_so_far<course_to_do) {
-					uart2_PutChar(course_buffer[course_so_far]);
-					++course_so_far;
-				}
-#endif
+				PORTC = PORTC ^ 0x10;
 			}
-		}    
 
-		// UART1: Output 1: GPS + HDG, 38400.
-		if (!uart1_IsRxEmpty())
-		{
-			ch = uart1_GetChar();
+			handle_gps_sentence(0, sentence, &gps_data);
+
+			send_heading_between_sentences();
 		}
+		uart0_SkipRx(span_length);
+	}    
+	send_heading_between_sentences();
+
+	// UART1: Output 1: GPS + HDG, 38400.
+	if (!uart1_IsRxEmpty())
+	{
+		ch = uart1_GetChar();
+	}
 
 
-		// UART2: Setup channel.
-		// UART1: Output 1: Compass, 9600, 25Hz., Sentence: HDG.
-		if (!uart2_IsRxEmpty())
-		{
-			ch = uart2_GetChar();
-			uart2_PutChar(ch);
-			setup_handle_input(ch, &setup);
-		}
+	// UART2: Setup channel.
+	// UART2: Output 1: Compass, 9600, setup.heading_rate, Sentence: HDG, from TIMER1_COMPA_vect.
+	// Listings go out as the port has room, typed input waits for them and for room for its reply.
+	setup_continue_listing();
+	if (setup_is_ready() && !uart2_IsRxEmpty())
+	{
+		ch = uart2_GetChar();
+		uart2_PutChar(ch);
+		setup_handle_input(ch, &setup);
+	}
+
 
+	// UART3: Data from the secondary GPS, not echoed.
+	if (!uart3_IsRxEmpty())
+	{
+		RECEIVER*		receiver = &receivers[1];
+		const uint8_t*	span;
+		const uint16_t	span_length = uart3_PeekRx(&span);
+		uint16_t		span_done = 0;
+
+		while (span_done < span_length) {
+			SENTENCE		sentence;
+			const uint8_t*	chunk = span + span_done;
+			const uint16_t	chunk_length = handle_gps_span(&receiver->parser, chunk, span_length - span_done, &sentence, &gps_data);
+
+			span_done += chunk_length;
+			if (chunk[chunk_length - 1] == '$') {
+				// Arrival time from the RX interrupt, as on UART0.
+				if (!uart3_GetStamp(chunk + chunk_length - 1, &receiver->start)) {
+					receiver->start.count = timer1_count();
+				}
+			}
 
-		// Empty channel - not working?
-		if (!uart3_IsRxEmpty())
-		{
-			ch = uart3_GetChar();
-			uart3_PutChar(ch);
+			handle_gps_sentence(1, sentence, &gps_data);
 		}
+		uart3_SkipRx(span_length);
 	}
+
+	PROFILE_END(loop_start, PROFILE_MAIN_LOOP);
 }
 
+/*****************************************************************************/
+int
+main(void)
+{
+	io_Init();
+	uart_Init();
+	profile_init();
+	
+	sei();
+
+	setup_send_P(PSTR("\r\nWelcome to GPS BLESSER v1.0!\r\n"));
+	// The settings listing ends with the prompt.
+	setup_load_from_nvram(&setup);
+
+	for (;;) {
+		handle_uarts();
+	}
+}
@@ -6,20 +6,98 @@
 
 #define	HEADINGS_PER_SECOND	25
 
-extern int32_t
-getticksoftheday();
+/** Time since 2000-01-01 00:00:00 UTC. */
+typedef struct {
+	uint32_t	seconds;
+	/** 0 .. PRECISION_TICKS_PER_SECOND-1 */
+	uint16_t	ticks;
+} EPOCH_TIME;
 
 extern void
-addticksoftheday(	const int32_t		extra_ticks);
+gettimebase(		EPOCH_TIME*		t);
 
-extern void setticksoftheday(	const int32_t		ticks);
+extern void
+addtimebase(		const int32_t		extra_ticks);
+
+extern void
+settimebase(		const EPOCH_TIME*	t);
 
 extern bool
-is_ticksoftheday_valid();
+is_timebase_valid();
+
+/** Add (possibly negative) ticks to t, carrying into seconds. */
+extern void
+epoch_add(			EPOCH_TIME*			t,
+					const int32_t		extra_ticks);
+
+/** a - b in ticks, saturated to about +-24 days. */
+extern int32_t
+epoch_difference(	const EPOCH_TIME*	a,
+					const EPOCH_TIME*	b);
+
+/** Counters of one UART, kept by usart.c. */
+typedef struct {
+	uint32_t	rx_bytes;		///< Received without errors.
+	uint32_t	tx_bytes;		///< Sent.
+	uint16_t	rx_drops;		///< Lost to a full RX ring.
+	uint16_t	tx_drops;		///< Lost to a full TX ring.
+	uint16_t	frame_errors;	///< FE
+	uint16_t	overruns;		///< DOR
+	uint16_t	parity_errors;	///< UPE
+	uint8_t		rx_peak;		///< Most bytes waiting in the RX ring.
+	uint8_t		tx_peak;		///< Most bytes waiting in the TX ring, with a staged sentence.
+} UART_STATS;
+
+/** Runtime statistics, shown and reset by the setup command 's'.
+ * ISRs update them too, read them with interrupts disabled.
+ */
+typedef struct {
+	UART_STATS	uart[4];
+	/** Sentences with a valid checksum, indexed by SENTENCE. Other types count as SENTENCE_NONE. */
+	uint32_t	sentences[4];
+	/** Sentences with a wrong checksum, or none. */
+	uint16_t	checksum_errors;
+	/** Fields too long, the parser waits for the next '$'. */
+	uint16_t	parser_restarts;
+	/** Offsets too large to steer, stepped by at most the offset limit. */
+	uint16_t	time_steps;
+	/** Offsets beyond the jump limit, stepped whole. */
+	uint16_t	time_jumps;
+} STATS;
+
+extern STATS	stats;
+
+/** Stack painting pattern, see stack_unused. */
+#define	STACK_CANARY	0xC5
+
+/** Bytes between the static data and the deepest stack use since boot. */
+extern uint16_t
+stack_unused(void);
+
+/** Timer1 overflows, only for gettimestamp_isr. Use gettimebase() elsewhere. */
+extern volatile uint16_t	timer1_overflows;
+
+/** Arrival time of a byte, captured in an ISR. */
+typedef struct {
+	/** Free-running Timer1 count, extended to 32 bits. */
+	uint32_t	count;
+} TIMESTAMP;
+
+/** Capture current Timer1 count into TIMESTAMP ts. Interrupts must be disabled.
+ * A pending overflow with a small count means the overflow ISR has not counted it yet. */
+#define	gettimestamp_isr(ts) do {					\
+	const uint16_t	low_ = TCNT1;					\
+	uint16_t	high_ = timer1_overflows;			\
+	if ((TIFR1 & _BV(TOV1)) && low_ < 0x8000) {			\
+		++high_;						\
+	}								\
+	(ts).count = ((uint32_t)high_ << 16) | low_;			\
+} while (0)
 
 /** Precision timer for syncing. */
 #define	PRECISION_TICKS_PER_SECOND				(1000)
 #define	PRECISION_TICKS_PER_DAY					(24L*3600L*PRECISION_TICKS_PER_SECOND)
+#define	SECONDS_PER_DAY							(24L*3600L)
 /** SmartFlasher SYNC pulse, 140 ms. */
 #define	PRECISION_TICKS_PER_SYNC				504
 /** SmartFlasher startup-delay, 50 ms. */
@@ -29,6 +107,9 @@ is_ticksoftheday_valid();
 /** Number of ticks before syncro impulse to turn GPS on. */
 #define	PRECISION_TICKS_GPS_LEAD					(240L * PRECISION_TICKS_PER_SECOND)
 
+/** Receiver without valid time this long is failed over, 1.5 seconds. */
+#define	PRECISION_TICKS_FAILOVER				(1500L)
+
 #define	PRECISION_TICKS_PER_HEADING				(PRECISION_TICKS_PER_SECOND / HEADINGS_PER_SECOND)
 
 #endif /* main_h_ */
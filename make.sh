@@ -1,9 +1,35 @@
 #! /bin/sh
 
+# host benchmarks and tests, with the host compiler and the stand-ins in host/:
+#    ./make.sh host                         build into host/build, run the tests
+#    host/build/bench_gps [gps.txt ...]     parser throughput
+#    host/build/bench_classify              sentence classifier against the old memcmp_P chain
+#    host/build/sim_timebase                Timer1 frequency loop against the step-only algorithm
+#    host/build/replay [-p ppm] [-o uart1.out] gps.txt ...
+#                                           logs through the main loop, PPS edges and UART1 output
+#    host/build/wcet_gps [budget]           worst handle_gps_input call, adversarial over normal input
+if [ "$1" = "host" ]; then
+	HOSTCC=${HOSTCC:-cc}
+	HOSTFLAGS="-O2 -std=gnu99 -Wall -Wno-format -Ihost -I. -DF_CPU=8000000 -DGPS_IGNORE_FIX=1"
+	mkdir -p host/build || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/bench_gps host/bench_gps.c gps.c || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/wcet_gps host/wcet_gps.c gps.c || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/bench_classify host/bench_classify.c || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/test_trig host/test_trig.c trig.c -lm || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/test_uart1 host/test_uart1.c host/avr.c usart.c gps.c || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/sim_timebase host/sim_timebase.c host/avr.c usart.c gps.c setup.c trig.c profile.c -lm || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/replay host/replay.c host/avr.c usart.c gps.c setup.c trig.c profile.c -lm || exit 1
+	$HOSTCC $HOSTFLAGS -o host/build/test_timesync host/test_timesync.c host/avr.c usart.c gps.c setup.c trig.c profile.c -lm || exit 1
+	for t in test_trig test_uart1 test_timesync wcet_gps; do
+		host/build/$t || exit 1
+	done
+	exit 0
+fi
+
 # fuse settings compared to defaults:
 #    external crystal oscillator, 3 ... 8 MHz, JTAG disabled, brownout at 2.7V.
 export MICRO=../Micro
-make -f $MICRO/Makefile LFUSE=0xDD HFUSE=0xD1 EFUSE=0xF5 NAME=gpsblesser MCU=atmega1280 CFLAGS="-DF_CPU=8000000 -DGPS_IGNORE_FIX=1" "SRC=usart.c gps.c setup.c main.c"  LDFLAGS="-Wl,-u,vfprintf -lm" IFACE=avrdude $*
+make -f $MICRO/Makefile LFUSE=0xDD HFUSE=0xD1 EFUSE=0xF5 NAME=gpsblesser MCU=atmega1280 CFLAGS="-DF_CPU=8000000 -DGPS_IGNORE_FIX=1" "SRC=usart.c gps.c setup.c trig.c profile.c main.c"  LDFLAGS="" IFACE=avrdude $*
 
 # do not use "-lprintf_flt"
-
+# profiling build: add -DPROFILE=1 to CFLAGS, then "p" on the setup channel.
@@ -0,0 +1,97 @@
+// vim: ts=4 shiftwidth=4
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdbool.h>	// bool
+#include <stdio.h>	// sprintf_P
+#include <string.h>	// memset
+#include "profile.h"
+
+#if (PROFILE)
+#include "setup.h"	// setup_send
+
+PROFILE_STATS		profile_stats[PROFILE_SLOTS];
+
+/** Timer3 overflows, upper half of profile_now. */
+static volatile uint16_t	timer3_overflows = 0;
+
+/** Slot names, in PROFILE_SLOT order, padded to the column. */
+static const char	profile_names[PROFILE_SLOTS][9] PROGMEM = {
+	"T1COMPA ", "T1OVF   ", "T1COMPB ",
+	"U0RX    ", "U1RX    ", "U2RX    ", "U3RX    ",
+	"U0TX    ", "U1TX    ", "U2TX    ", "U3TX    ",
+	"MAIN    ",
+	"GPSNONE ", "GPSGGA  ", "GPSVTG  ", "GPSZDA  ",
+};
+
+/*****************************************************/
+ISR (TIMER3_OVF_vect)
+{
+	++timer3_overflows;
+}
+
+/*****************************************************************************/
+void
+profile_init(void)
+{
+	TCCR3A = 0;
+	TCCR3B = (1<<CS30); // F_CPU
+	TIMSK3 |= (1<<TOIE3);
+}
+
+/*****************************************************************************/
+uint32_t
+profile_now(void)
+{
+	const bool	interrupts_enabled = (SREG & 0x80) != 0;
+	uint16_t	low;
+	uint16_t	high;
+
+	cli();
+	low = TCNT3;
+	high = timer3_overflows;
+	// Wrapped, overflow not yet handled?
+	if ((TIFR3 & (1<<TOV3)) && low < 0x8000) {
+		++high;
+	}
+	if (interrupts_enabled) {
+		sei();
+	}
+	return ((uint32_t)high << 16) | low;
+}
+
+/*****************************************************************************/
+bool
+profile_print_line(	const uint8_t	line)
+{
+	char			xbuf[64];
+	PROFILE_STATS	p;
+
+	if (line == 0) {
+		setup_send_P(PSTR("SLOT    COUNT MIN        MAX        MEAN (cycles)\r\n"));
+		return true;
+	} else if (line > PROFILE_SLOTS) {
+		return false;
+	}
+
+	cli();
+	p = profile_stats[line - 1];
+	sei();
+
+	setup_send_P(profile_names[line - 1]);
+	sprintf_P(xbuf, PSTR("%-5u %-10lu %-10lu %lu\r\n"),
+		p.count, p.min, p.max, p.count>0 ? p.sum / p.count : 0ul);
+	setup_send(xbuf);
+	return true;
+}
+
+/*****************************************************************************/
+void
+profile_reset(void)
+{
+	cli();
+	memset(profile_stats, 0, sizeof(profile_stats));
+	sei();
+}
+
+#endif /* PROFILE */
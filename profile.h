@@ -0,0 +1,100 @@
+// vim: ts=4 shiftwidth=4
+#ifndef profile_h_
+#define profile_h_
+
+#include <stdint.h>	// uint16_t, etc.
+#include <stdbool.h>	// bool
+
+/** Cycle profiler on Timer3, build with -DPROFILE=1. Without it the macros below are empty. */
+#ifndef PROFILE
+#define	PROFILE	0
+#endif
+
+/** What is measured. The PROFILE_GPS_ slots are indexed by SENTENCE. */
+typedef enum {
+	PROFILE_TIMER1_COMPA = 0,
+	PROFILE_TIMER1_OVF,
+	PROFILE_TIMER1_COMPB,
+	PROFILE_USART0_RX,
+	PROFILE_USART1_RX,
+	PROFILE_USART2_RX,
+	PROFILE_USART3_RX,
+	PROFILE_USART0_TX,
+	PROFILE_USART1_TX,
+	PROFILE_USART2_TX,
+	PROFILE_USART3_TX,
+	PROFILE_MAIN_LOOP,		///< One pass of the main loop.
+	PROFILE_GPS_NONE,		///< handle_gps_span chunks completing no sentence.
+	PROFILE_GPS_GGA,
+	PROFILE_GPS_VTG,
+	PROFILE_GPS_ZDA,
+	PROFILE_SLOTS
+} PROFILE_SLOT;
+
+#if (PROFILE)
+
+/** Cycles of one slot. ISR slots start after the ISR prologue and end before the epilogue. */
+typedef struct {
+	uint32_t	min;
+	uint32_t	max;
+	/** Sum and count are halved together before either overflows, the mean stays. */
+	uint32_t	sum;
+	uint16_t	count;
+} PROFILE_STATS;
+
+extern PROFILE_STATS	profile_stats[PROFILE_SLOTS];
+
+/** Record one measurement. Interrupts must be disabled, or the slot never used by an ISR. */
+static inline void
+profile_add(		const uint8_t	slot,
+					const uint32_t	cycles)
+{
+	PROFILE_STATS*	p = &profile_stats[slot];
+
+	if (p->count == 0 || cycles < p->min) {
+		p->min = cycles;
+	}
+	if (cycles > p->max) {
+		p->max = cycles;
+	}
+	if (p->count == 0xFFFF || p->sum > 0xFFFFFFFFul - cycles) {
+		p->sum >>= 1;
+		p->count >>= 1;
+	}
+	p->sum += cycles;
+	++p->count;
+}
+
+/** Start Timer3 free-running at F_CPU. */
+extern void
+profile_init(void);
+
+/** CPU cycles, 32 bits, for main-loop slots. */
+extern uint32_t
+profile_now(void);
+
+/** Print line \c line of the slot listing on the setup channel. Returns false past the last one. */
+extern bool
+profile_print_line(	const uint8_t	line);
+
+extern void
+profile_reset(void);
+
+/** ISRs are much shorter than a Timer3 wrap, 16 bits are enough. */
+#define	PROFILE_ISR_BEGIN()		const uint16_t	profile_isr_start_ = TCNT3
+#define	PROFILE_ISR_END(slot)	profile_add((slot), (uint16_t)(TCNT3 - profile_isr_start_))
+#define	PROFILE_BEGIN(start)	const uint32_t	start = profile_now()
+#define	PROFILE_END(start, slot)	profile_add((slot), profile_now() - (start))
+
+#else
+
+#define	profile_init()
+#define	profile_reset()
+#define	PROFILE_ISR_BEGIN()
+#define	PROFILE_ISR_END(slot)
+#define	PROFILE_BEGIN(start)
+#define	PROFILE_END(start, slot)
+
+#endif /* PROFILE */
+
+#endif /* profile_h_ */
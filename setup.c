@@ -4,11 +4,14 @@
 #include <stdio.h>	// sprintf_P
 #include <stdlib.h>	// strtol
 #include <errno.h>	// errno
-#include <limits.h>	// LONG_MIN
+#include <stdint.h>	// INT32_MIN
 #include <ctype.h>	// isalnum
-#include <string.h>	// strlen
+#include <string.h>	// strlen, memset
+#include <avr/interrupt.h>	// cli, sei
 #include "setup.h"
 #include "usart.h"
+#include "gps.h"	// SENTENCE
+#include "profile.h"
 
 #define	EEPROM_START_ADDRESS	((uint8_t*)(8))
 
@@ -16,22 +19,14 @@
 void
 setup_send(	const char*	s)
 {
-	for (; *s != 0; ++s) {
-		uart2_PutChar(*s);
-	}
+	uart2_Write((const uint8_t*)s, strlen(s));
 }
 
 /*****************************************************************************/
 void
 setup_send_P(			PGM_P	s)
 {
-	for (;;) {
-		const char c = pgm_read_byte(s++);
-		if (c==0) {
-			break;
-		}
-		setup_send_char(c);
-	}
+	uart2_Write_P(s, strlen_P(s));
 }
 
 /*****************************************************************************/
@@ -56,6 +51,15 @@ setup_send_newline()
 	setup_send_P(PSTR("\r\n"));
 }
 
+/*****************************************************************************/
+static void
+setup_send_long(			const int32_t	i)
+{
+	char	xbuf[12];
+	sprintf_P(xbuf, PSTR("%ld"), i);
+	setup_send(xbuf);
+}
+
 /*****************************************************************************/
 void
 setup_send_integer(
@@ -63,11 +67,9 @@ setup_send_integer(
 	const int32_t	i,
 	PGM_P		unit)
 {
-	char	xbuf[14];
 	setup_send_P(name);
 	setup_send_P(PSTR(" = "));
-	sprintf_P(xbuf, PSTR("%ld"), i);
-	setup_send(xbuf);
+	setup_send_long(i);
 	setup_send_P(unit);
 	setup_send_newline();
 }
@@ -112,21 +114,198 @@ setup_crc(const SETUP* setup)
 	return r;
 }
 
+/*****************************************************************************/
+/** Line \c line of the settings listing. Returns false past the last one. */
+static bool
+setup_print_line(	const SETUP*	setup,
+					const uint8_t	line)
+{
+	switch (line) {
+		case 0:
+			setup_send_P(      PSTR("N  NAME             VALUE\r\n"));
+			break;
+		case 1:
+			setup_send_boolean(PSTR("0: Realtime show   "), setup->realtime_show);
+			break;
+		case 2:
+			setup_send_integer(PSTR("1: Pulse length    "), setup->pulse_length, PSTR("ms."));
+			break;
+		case 3:
+			setup_send_integer(PSTR("2: Pulse offset    "), setup->pulse_offset, PSTR("ms."));
+			break;
+		case 4:
+			setup_send_integer(PSTR("3: Offset limit    "), setup->offset_limit, PSTR("ms."));
+			break;
+		case 5:
+			setup_send_integer(PSTR("4: Jump limit      "), setup->jump_limit, PSTR("ms."));
+			break;
+		case 6:
+			setup_send_integer(PSTR("5: Reaction speed  "), setup->reaction_speed, PSTR("%."));
+			break;
+		case 7:
+			setup_send_string(PSTR("6: Compass sentence"), setup->compass_sentence);
+			break;
+		case 8:
+			setup_send_integer(PSTR("7: Heading source  "), setup->heading_source, PSTR(" (0=VTG, 1=GGA)."));
+			break;
+		case 9:
+			setup_send_integer(PSTR("8: Heading baseline"), setup->heading_baseline, PSTR("m."));
+			break;
+		case 10:
+			setup_send_integer(PSTR("9: Heading rate    "), setup->heading_rate, PSTR("Hz."));
+			break;
+		case 11:
+			setup_send_P(PSTR("Set new values as follows: N VALUE\r\n"));
+			break;
+		case 12:
+			setup_send_P(PSTR("Realtime show is toggled, no value needed. For example, set pulse length to 100ms:\r\n"));
+			break;
+		case 13:
+			setup_send_P(PSTR("1 100\r\n"));
+			break;
+		case 14:
+			setup_send_P(PSTR("Statistics: s shows, p shows the profile, r resets both."));
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+/*****************************************************************************/
+/** Line \c line of the statistics listing. Returns false past the last one. */
+static bool
+setup_print_stats_line(	const uint8_t	line)
+{
+	char		xbuf[64];
+
+	if (line == 0) {
+		setup_send_P(PSTR("UART RX_BYTES   TX_BYTES   RX_DROP TX_DROP FE    DOR   UPE\r\n"));
+	} else if (line <= 4) {
+		const uint8_t	i = line - 1;
+		UART_STATS		u;
+
+		// ISRs count these, one UART at a time keeps the copy small.
+		cli();
+		u = stats.uart[i];
+		sei();
+
+		sprintf_P(xbuf, PSTR("%u    %-10lu %-10lu %-7u %-7u %-5u %-5u %u\r\n"),
+			i, u.rx_bytes, u.tx_bytes, u.rx_drops, u.tx_drops, u.frame_errors, u.overruns, u.parity_errors);
+		setup_send(xbuf);
+	} else if (line == 5) {
+		setup_send_P(PSTR("UART RX_PEAK TX_PEAK\r\n"));
+	} else if (line <= 9) {
+		const uint8_t	i = line - 6;
+		uint8_t			rx_peak;
+		uint8_t			tx_peak;
+
+		cli();
+		rx_peak = stats.uart[i].rx_peak;
+		tx_peak = stats.uart[i].tx_peak;
+		sei();
+
+		sprintf_P(xbuf, PSTR("%u    %-7u %u\r\n"), i, rx_peak, tx_peak);
+		setup_send(xbuf);
+	} else {
+		switch (line) {
+			case 10:
+				setup_send_integer(PSTR("GGA sentences  "), stats.sentences[SENTENCE_GGA], PSTR(""));
+				break;
+			case 11:
+				setup_send_integer(PSTR("VTG sentences  "), stats.sentences[SENTENCE_VTG], PSTR(""));
+				break;
+			case 12:
+				setup_send_integer(PSTR("ZDA sentences  "), stats.sentences[SENTENCE_ZDA], PSTR(""));
+				break;
+			case 13:
+				setup_send_integer(PSTR("Other sentences"), stats.sentences[SENTENCE_NONE], PSTR(""));
+				break;
+			case 14:
+				setup_send_integer(PSTR("Checksum errors"), stats.checksum_errors, PSTR(""));
+				break;
+			case 15:
+				setup_send_integer(PSTR("Parser restarts"), stats.parser_restarts, PSTR(""));
+				break;
+			case 16:
+				setup_send_integer(PSTR("Time steps     "), stats.time_steps, PSTR(""));
+				break;
+			case 17:
+				setup_send_integer(PSTR("Time jumps     "), stats.time_jumps, PSTR(""));
+				break;
+			case 18:
+				setup_send_integer(PSTR("Stack unused   "), stack_unused(), PSTR(" bytes, never reached since boot."));
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************************/
+/** Listings go out a line at a time, so the main loop keeps running while the console sends them. */
+typedef enum {
+	LISTING_NONE = 0,
+	LISTING_SETUP,
+	LISTING_STATS,
+	LISTING_PROFILE
+} LISTING;
+
+/** Console room for one more line: the longest listing line or reply to a typed character, with room
+ * left for the HDG. */
+#define	SETUP_LINE_ROOM		128
+
+static LISTING			listing = LISTING_NONE;
+static uint8_t			listing_line = 0;
+static const SETUP*		listing_setup = NULL;
+
 /*****************************************************************************/
 static void
-setup_print(const SETUP* setup)
+setup_start_listing(	const LISTING	what,
+						const SETUP*	setup)
 {
-	setup_send_P(      PSTR("N  NAME             VALUE\r\n"));
-	setup_send_boolean(PSTR("0: Realtime show   "), setup->realtime_show);
-	setup_send_integer(PSTR("1: Pulse length    "), setup->pulse_length, PSTR("ms."));
-	setup_send_integer(PSTR("2: Pulse offset    "), setup->pulse_offset, PSTR("ms."));
-	setup_send_integer(PSTR("3: Offset limit    "), setup->offset_limit, PSTR("ms."));
-	setup_send_integer(PSTR("4: Jump limit      "), setup->jump_limit, PSTR("ms."));
-	setup_send_integer(PSTR("5: Reaction speed  "), setup->reaction_speed, PSTR("%."));
-	setup_send_string(PSTR("6: Compass sentence"), setup->compass_sentence);
-	setup_send_P(PSTR("Set new values as follows: N VALUE\r\n"));
-	setup_send_P(PSTR("Realtime show is toggled, no value needed. For example, set pulse length to 100ms:\r\n"));
-	setup_send_P(PSTR("1 100"));
+	listing = what;
+	listing_line = 0;
+	listing_setup = setup;
+}
+
+/*****************************************************************************/
+void
+setup_continue_listing(void)
+{
+	while (listing != LISTING_NONE && uart2_TxRoom() >= SETUP_LINE_ROOM) {
+		bool	more = false;
+
+		switch (listing) {
+			case LISTING_SETUP:
+				more = setup_print_line(listing_setup, listing_line);
+				break;
+			case LISTING_STATS:
+				more = setup_print_stats_line(listing_line);
+				break;
+#if (PROFILE)
+			case LISTING_PROFILE:
+				more = profile_print_line(listing_line);
+				break;
+#endif
+			default:
+				break;
+		}
+		++listing_line;
+		if (!more) {
+			listing = LISTING_NONE;
+			// Print prompt.
+			setup_send_P(PSTR("\r\n>"));
+		}
+	}
+}
+
+/*****************************************************************************/
+bool
+setup_is_ready(void)
+{
+	return listing == LISTING_NONE && uart2_TxRoom() >= SETUP_LINE_ROOM;
 }
 
 /*****************************************************************************/
@@ -139,11 +318,12 @@ setup_load_from_nvram(SETUP* setup)
 		(uint8_t*)(setup),
 		(void*)(EEPROM_START_ADDRESS+1), sizeof(*setup));
 
-	// 2. Check CRC.
-	if (setup_crc(setup) == crc2) {
-		setup_print(setup);
+	// 2. Check CRC and layout.
+	if (setup_crc(setup) == crc2 && setup->version == SETUP_VERSION) {
+		setup_start_listing(LISTING_SETUP, setup);
 		return true;
 	} else {
+		setup->version = SETUP_VERSION;
 		setup->realtime_show = true;
 		setup->pulse_length = 100;
 		setup->pulse_offset = 0;
@@ -151,7 +331,10 @@ setup_load_from_nvram(SETUP* setup)
 		setup->jump_limit = 2000;
 		setup->reaction_speed = 10;
 		strcpy_P(setup->compass_sentence, PSTR("HDHDT"));
-		setup_print(setup);
+		setup->heading_source = HEADING_SOURCE_VTG;
+		setup->heading_baseline = 5;
+		setup->heading_rate = HEADINGS_PER_SECOND;
+		setup_start_listing(LISTING_SETUP, setup);
 		return false;
 	}
 }
@@ -160,9 +343,9 @@ setup_load_from_nvram(SETUP* setup)
 void
 setup_store_to_nvram(const SETUP* setup)
 {
-	// 2. Write to the eeprom.
-	eeprom_write_byte(((uint8_t*)(EEPROM_START_ADDRESS)), setup_crc(setup));
-	eeprom_write_block(
+	// 2. Write to the eeprom. Each byte written takes 3.4ms, only the changed ones are.
+	eeprom_update_byte(((uint8_t*)(EEPROM_START_ADDRESS)), setup_crc(setup));
+	eeprom_update_block(
 		(const uint8_t*)(setup),
 		(void*)(EEPROM_START_ADDRESS+1), sizeof(*setup));
 }
@@ -177,7 +360,6 @@ parse_integer_in_range(
 	PGM_P		name,
 	PGM_P		unit)
 {
-	char		xbuf[128];
 	int32_t		new_value;
 	char*	endptr = s;
 
@@ -187,23 +369,21 @@ parse_integer_in_range(
 	if (errno==0 && endptr!=s) {
 		if (new_value >= min_value && new_value<=max_value) {
 			setup_send_P(name);
-
-			sprintf_P(xbuf, PSTR(" is now %ld"), new_value);
-			setup_send(xbuf);
-
+			setup_send_P(PSTR(" is now "));
+			setup_send_long(new_value);
 			setup_send_char(' ');
 			setup_send_P(unit);
 			setup_send_P(PSTR(".\r\n"));
 			return new_value;
 		} else {
 			setup_send_P(name);
-
-			sprintf_P(xbuf, PSTR(" %ld"), new_value);
-			setup_send(xbuf);
-
-			sprintf_P(xbuf, PSTR(" is out of the range %ld .. %ld \r\n"), min_value, max_value);
-			setup_send(xbuf);
-
+			setup_send_char(' ');
+			setup_send_long(new_value);
+			setup_send_P(PSTR(" is out of the range "));
+			setup_send_long(min_value);
+			setup_send_P(PSTR(" .. "));
+			setup_send_long(max_value);
+			setup_send_P(PSTR(" \r\n"));
 			return old_value;
 		}
 	} else {
@@ -212,9 +392,20 @@ parse_integer_in_range(
 	}
 }
 
+/*****************************************************************************/
+void
+setup_send_nowait_P(	PGM_P		s)
+{
+	char	xbuf[32];
+
+	strncpy_P(xbuf, s, sizeof(xbuf) - 1);
+	xbuf[sizeof(xbuf) - 1] = 0;
+	uart2_WriteAll((const uint8_t*)xbuf, strlen(xbuf));
+}
+
 /*****************************************************************************/
 static unsigned int	input_length = 0;
-static char		input_buffer[64];
+static char		input_buffer[32];
 
 void
 setup_handle_input(
@@ -228,7 +419,7 @@ setup_handle_input(
 		if (input_length>0) {
 			const char cmd = input_buffer[0];
 			if (cmd == '?') {
-				setup_print(setup);
+				setup_start_listing(LISTING_SETUP, setup);
 			} else if (cmd == '0') {
 				setup->realtime_show = !setup->realtime_show;
 				setup_store_to_nvram(setup);
@@ -237,6 +428,20 @@ setup_handle_input(
 				} else {
 					setup_send_P(PSTR("Realtime show is now OFF."));
 				}
+			} else if (cmd == 's') {
+				setup_start_listing(LISTING_STATS, setup);
+			} else if (cmd == 'p') {
+#if (PROFILE)
+				setup_start_listing(LISTING_PROFILE, setup);
+#else
+				setup_send_P(PSTR("Profiler not built in, see PROFILE."));
+#endif
+			} else if (cmd == 'r') {
+				cli();
+				memset(&stats, 0, sizeof(stats));
+				sei();
+				profile_reset();
+				setup_send_P(PSTR("Statistics reset."));
 			} else if (input_length>2) {
 				switch (cmd) {
 					case '1':
@@ -263,7 +468,7 @@ setup_handle_input(
 					case '4':
 						setup->jump_limit = parse_integer_in_range(
 							input_buffer + 2,
-							LONG_MIN, LONG_MAX, setup->jump_limit,
+							INT32_MIN, INT32_MAX, setup->jump_limit,
 							PSTR("Jump limit"), PSTR("ms"));
 						setup_store_to_nvram(setup);
 						break;
@@ -291,11 +496,34 @@ setup_handle_input(
 							}
 						}
 						break;
+					case '7':
+						setup->heading_source = parse_integer_in_range(
+							input_buffer + 2,
+							HEADING_SOURCE_VTG, HEADING_SOURCE_GGA, setup->heading_source,
+							PSTR("Heading source"), PSTR(""));
+						setup_store_to_nvram(setup);
+						break;
+					case '8':
+						setup->heading_baseline = parse_integer_in_range(
+							input_buffer + 2,
+							1, 500, setup->heading_baseline,
+							PSTR("Heading baseline"), PSTR("m"));
+						setup_store_to_nvram(setup);
+						break;
+					case '9':
+						setup->heading_rate = parse_integer_in_range(
+							input_buffer + 2,
+							1, 50, setup->heading_rate,
+							PSTR("Heading rate"), PSTR("Hz"));
+						setup_store_to_nvram(setup);
+						break;
 				}
 			}
 		}
-		// Print prompt.
-		setup_send_P(PSTR("\r\n>"));
+		// Print prompt, after the listing if one was started.
+		if (listing == LISTING_NONE) {
+			setup_send_P(PSTR("\r\n>"));
+		}
 		input_length = 0;
 	} else if (c == 0x08) {
 		// it is nice to handle backspace.
@@ -7,7 +7,19 @@
 
 /** Setup channel. */
 
+/** Heading from VTG course over ground. */
+#define	HEADING_SOURCE_VTG	0
+/** Heading from successive GGA positions. */
+#define	HEADING_SOURCE_GGA	1
+
+/** Layout of SETUP in EEPROM. Bump it when fields change; a stored setup of another layout is
+ * replaced by the defaults. The first layout had no version, its first byte is 0 or 1. */
+#define	SETUP_VERSION		2
+
 typedef struct {
+	/** SETUP_VERSION of the layout. */
+	uint8_t	version;
+
 	/** Are we showing offsets in realtime? */
 	bool	realtime_show;
 
@@ -17,7 +29,7 @@ typedef struct {
 	/** Pulse offset, milliseconds. Default: 0ms. */
 	int16_t	pulse_offset;
 
-	/** Synchronization offset limit, milliseconds. Default: 10ms. */
+	/** Synchronization offset limit, the largest step per time sentence, milliseconds. Default: 10ms. */
 	int16_t	offset_limit;
 
 	/** Jump limit, milliseconds. Default: 2000ms. */
@@ -28,6 +40,15 @@ typedef struct {
 
 	/** NMEA compass sentence. Must be 5 chars. Default: HDHDT. */
 	char	compass_sentence[6];
+
+	/** Heading source, HEADING_SOURCE_VTG or HEADING_SOURCE_GGA. Default: VTG. */
+	int16_t	heading_source;
+
+	/** Distance between GGA positions for the heading, meters. Default: 5m. */
+	int16_t	heading_baseline;
+
+	/** HDG sentences per second on the compass port, 1..50. Default: HEADINGS_PER_SECOND. */
+	int16_t	heading_rate;
 } SETUP;
 
 /** CRC calculation. */
@@ -50,6 +71,10 @@ setup_send(		const char*	s);
 extern void
 setup_send_P(		PGM_P				s);
 
+/** Queue a short message (up to 31 characters) whole, or drop it when the console is busy. Never waits. */
+extern void
+setup_send_nowait_P(	PGM_P				s);
+
 extern void
 setup_send_hex(		const uint8_t	x);
 
@@ -59,6 +84,15 @@ setup_send_integer(
 	const int32_t	i,
 	PGM_P		unit);
 
+/** Send the next lines of a listing ('?', 's', 'p') while the console has room. Call from the main loop. */
+extern void
+setup_continue_listing(void);
+
+/** Can the console take a typed character? Not while a listing is sent, nor until UART2 has room
+ * for the longest reply, so the echo and the reply never wait for the port. */
+extern bool
+setup_is_ready(void);
+
 /** Handle input. */
 extern void
 setup_handle_input(
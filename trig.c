@@ -0,0 +1,126 @@
+// vim: ts=4 shiftwidth=4
+#include <avr/pgmspace.h>
+#include <stdint.h>	// int16_t, etc.
+#include <stdbool.h>	// bool
+#include "trig.h"
+
+/** sin(i degrees), x16384, i=0..90. */
+static const int16_t	sin_table[91] PROGMEM = {
+	0, 286, 572, 857, 1143, 1428, 1713, 1997, 2280, 2563,
+	2845, 3126, 3406, 3686, 3964, 4240, 4516, 4790, 5063, 5334,
+	5604, 5872, 6138, 6402, 6664, 6924, 7182, 7438, 7692, 7943,
+	8192, 8438, 8682, 8923, 9162, 9397, 9630, 9860, 10087, 10311,
+	10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+	12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+	14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+	15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+	16384,
+};
+
+/** atan(i/64) in 0.01/8 degrees, i=0..64. */
+static const uint16_t	atan_table[65] PROGMEM = {
+	0, 716, 1432, 2147, 2861, 3574, 4285, 4994, 5700, 6404,
+	7105, 7802, 8496, 9186, 9871, 10552, 11229, 11901, 12567, 13228,
+	13883, 14533, 15176, 15814, 16445, 17069, 17688, 18299, 18904, 19501,
+	20092, 20676, 21252, 21821, 22384, 22939, 23486, 24027, 24560, 25086,
+	25604, 26116, 26620, 27117, 27607, 28090, 28565, 29034, 29496, 29951,
+	30399, 30840, 31275, 31703, 32125, 32540, 32949, 33351, 33748, 34138,
+	34522, 34900, 35272, 35639, 36000,
+};
+
+/*****************************************************************************/
+/** sin of 0 .. 9000, linear interpolation between whole degrees. */
+static int16_t
+sin_quadrant(		const uint16_t	angle_x100)
+{
+	const uint8_t	index = angle_x100 / 100;
+	const uint8_t	fraction = angle_x100 - index*100;
+	const int16_t	s0 = pgm_read_word(&sin_table[index]);
+
+	if (fraction == 0) {
+		return s0;
+	} else {
+		const int16_t	s1 = pgm_read_word(&sin_table[index + 1]);
+		return s0 + ((s1 - s0) * fraction + 50) / 100;
+	}
+}
+
+/*****************************************************************************/
+int16_t
+trig_sin_x14(		uint16_t		angle_x100)
+{
+	while (angle_x100 >= 36000u) {
+		angle_x100 -= 36000u;
+	}
+
+	if (angle_x100 < 9000) {
+		return sin_quadrant(angle_x100);
+	} else if (angle_x100 < 18000) {
+		return sin_quadrant(18000 - angle_x100);
+	} else if (angle_x100 < 27000) {
+		return -sin_quadrant(angle_x100 - 18000);
+	} else {
+		return -sin_quadrant(36000u - angle_x100);
+	}
+}
+
+/*****************************************************************************/
+int16_t
+trig_cos_x14(		uint16_t		angle_x100)
+{
+	while (angle_x100 >= 36000u) {
+		angle_x100 -= 36000u;
+	}
+	return trig_sin_x14(angle_x100 + 9000);
+}
+
+/*****************************************************************************/
+uint16_t
+trig_atan2_x100(	const int32_t	y,
+					const int32_t	x)
+{
+	uint32_t	a = x<0 ? -(uint32_t)x : (uint32_t)x;
+	uint32_t	b = y<0 ? -(uint32_t)y : (uint32_t)y;
+	const bool	swapped = b > a;
+	uint16_t	ratio;
+	uint8_t		index;
+	uint16_t	angle;
+
+	// 1. First octant, b/a in 0..1.
+	if (swapped) {
+		const uint32_t	t = a;
+		a = b;
+		b = t;
+	}
+	if (a == 0) {
+		return 0;
+	}
+	while (a > 0x1FFFFul) {
+		a >>= 1;
+		b >>= 1;
+	}
+	ratio = (b << 14) / a;
+
+	// 2. Table lookup, index in 1/64, fraction in 1/256 of that.
+	index = ratio >> 8;
+	angle = pgm_read_word(&atan_table[index]);
+	if ((ratio & 0xFF) != 0) {
+		const uint16_t	next = pgm_read_word(&atan_table[index + 1]);
+		angle += ((uint32_t)(next - angle) * (ratio & 0xFF)) >> 8;
+	}
+	angle = (angle + 4) >> 3;
+
+	// 3. Back to the full circle.
+	if (swapped) {
+		angle = 9000 - angle;
+	}
+	if (x < 0) {
+		angle = 18000 - angle;
+	}
+	if (y < 0 && angle != 0) {
+		angle = 36000u - angle;
+	}
+	return angle;
+}
+
@@ -0,0 +1,23 @@
+// vim: ts=4 shiftwidth=4
+#ifndef trig_h_
+#define trig_h_
+
+#include <stdint.h>	// int16_t, etc.
+
+/** Fixed-point trigonometry, no floating point. Angles are in 0.01 degrees. */
+
+/** sin(angle), x16384. */
+extern int16_t
+trig_sin_x14(		uint16_t		angle_x100);
+
+/** cos(angle), x16384. */
+extern int16_t
+trig_cos_x14(		uint16_t		angle_x100);
+
+/** atan2(y, x), 0 .. 35999. Error within 0.01 degrees. Zero vector gives 0. */
+extern uint16_t
+trig_atan2_x100(	const int32_t	y,
+					const int32_t	x);
+
+#endif /* trig_h_ */
+
@@ -5,432 +5,419 @@
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #include <avr/sleep.h>
+#include <avr/pgmspace.h>
 #include "usart.h"
-
-#define NUMBER_OF_UARTS 4
-
-static uint16_t rx_head[NUMBER_OF_UARTS], rx_tail[NUMBER_OF_UARTS];
-static uint16_t tx_head[NUMBER_OF_UARTS], tx_tail[NUMBER_OF_UARTS];
-static volatile uint16_t rx_count[NUMBER_OF_UARTS];
-static volatile uint16_t tx_count[NUMBER_OF_UARTS];
-uint8_t uart0_rx_buffer[UART0_RX_BUFFER_SIZE];
-uint8_t uart0_tx_buffer[UART0_TX_BUFFER_SIZE];
-uint8_t uart1_rx_buffer[UART1_RX_BUFFER_SIZE];
-uint8_t uart1_tx_buffer[UART1_TX_BUFFER_SIZE];
-uint8_t uart2_rx_buffer[UART2_RX_BUFFER_SIZE];
-uint8_t uart2_tx_buffer[UART2_TX_BUFFER_SIZE];
-uint8_t uart3_rx_buffer[UART3_RX_BUFFER_SIZE];
-uint8_t uart3_tx_buffer[UART3_TX_BUFFER_SIZE];
-
-
-/*****************************************************/
-void uart_Init(void)
-/*****************************************************/
-{
-	int i;
-
-	for(i = 0; i < NUMBER_OF_UARTS; i++)
-	{
-		rx_head[i] = rx_tail[i] = 0;
-		tx_head[i] = tx_tail[i] = 0;
-		rx_count[i] = 0;
-		tx_count[i] = 0;
-	}	
-
-	UBRR0 = UBRR0_RELOAD;
-	UCSR0A = 0; //_BV(U2X0);
-	UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0) | _BV(TXCIE0);
-	UCSR0C = _BV(UCSZ00) | _BV(UCSZ01);
-
-	UBRR1 = UBRR1_RELOAD;
-	UCSR1A = 0; //_BV(U2X1);
-	UCSR1B = _BV(RXEN1) | _BV(TXEN1) | _BV(RXCIE1) | _BV(TXCIE1);
-	UCSR1C = _BV(UCSZ10) | _BV(UCSZ11);
-
-	UBRR2 = UBRR2_RELOAD;
-	UCSR2A = 0;
-	UCSR2B = _BV(RXEN2) | _BV(TXEN2) | _BV(RXCIE2) | _BV(TXCIE2);
-	UCSR2C = _BV(UCSZ20) | _BV(UCSZ21);
-	
-	UBRR3 = UBRR3_RELOAD;
-	UCSR3A = 0;
-	UCSR3B = _BV(RXEN3) | _BV(TXEN3) | _BV(RXCIE3) | _BV(TXCIE3);
-	UCSR3C = _BV(UCSZ30) | _BV(UCSZ31);
-}
-
-
-/*****************************************************/
-ISR(USART0_RX_vect)
-/*****************************************************/
-{
-	uint8_t status, data;
-
-	status = UCSR0A;
-	data = UDR0;
-
-	if(!(status & (_BV(FE0) | _BV(UPE0) | _BV(DOR0))))
-	{
-		if(rx_count[0] < UART0_RX_BUFFER_SIZE)
-		{
-
-			uart0_rx_buffer[rx_tail[0]++] = data;
-			if(rx_tail[0] >= UART0_RX_BUFFER_SIZE)
-			rx_tail[0] = 0;
-
-			rx_count[0]++;
-		}
-	}
-}
-
-/*****************************************************/
-ISR(USART1_RX_vect)
-/*****************************************************/
-{
-	uint8_t status, data;
-
-	status = UCSR1A;
-	data = UDR1;
-
-	if(!(status & (_BV(FE1) | _BV(UPE1) | _BV(DOR1))))
-	{
-		
-		uart1_rx_buffer[rx_tail[1]++] = data;
-		if(rx_tail[1] >= UART1_RX_BUFFER_SIZE)
-			rx_tail[1] = 0;
-
-		rx_count[1]++;
-	}
-}
-
-/*****************************************************/
-ISR(USART2_RX_vect)
-/*****************************************************/
-{
-	uint8_t status, data;
-
-	status = UCSR2A;
-	data = UDR2;
-
-	if(!(status & (_BV(FE2) | _BV(UPE2) | _BV(DOR2))))
-	{
-		
-		uart2_rx_buffer[rx_tail[2]++] = data;
-		if(rx_tail[2] >= UART2_RX_BUFFER_SIZE)
-			rx_tail[2] = 0;
-
-		rx_count[2]++;
-	}
-}
-
-/*****************************************************/
-ISR(USART3_RX_vect)
-/*****************************************************/
-{
-	uint8_t status, data;
-
-	status = UCSR3A;
-	data = UDR3;
-
-	if(!(status & (_BV(FE3) | _BV(UPE3) | _BV(DOR3))))
-	{
-		
-		uart3_rx_buffer[rx_tail[3]++] = data;
-		if(rx_tail[3] >= UART3_RX_BUFFER_SIZE)
-			rx_tail[3] = 0;
-
-		rx_count[3]++;
-	}
-}
-
-/*****************************************************/
-ISR(USART0_TX_vect)
-/*****************************************************/
-{
-	if(tx_count[0])
-	{
-		UDR0 = uart0_tx_buffer[tx_head[0]++];
-		if(tx_head[0] >= UART0_TX_BUFFER_SIZE)
-			tx_head[0] = 0;
-		tx_count[0]--;
-	}
-}
-
-/*****************************************************/
-ISR(USART1_TX_vect)
-/*****************************************************/
-{
-	if(tx_count[1])
-	{
-		UDR1 = uart1_tx_buffer[tx_head[1]++];
-		if(tx_head[1] >= UART1_TX_BUFFER_SIZE)
-			tx_head[1] = 0;
-		tx_count[1]--;
-	}
-}
-
-/*****************************************************/
-ISR(USART2_TX_vect)
-/*****************************************************/
-{
-	if(tx_count[2])
-	{
-		UDR2 = uart2_tx_buffer[tx_head[2]++];
-		if(tx_head[2] >= UART2_TX_BUFFER_SIZE)
-			tx_head[2] = 0;
-		tx_count[2]--;
-	}
-}
-
-/*****************************************************/
-ISR(USART3_TX_vect)
-/*****************************************************/
-{
-	if(tx_count[3])
-	{
-		UDR3 = uart3_tx_buffer[tx_head[3]++];
-		if(tx_head[3] >= UART3_TX_BUFFER_SIZE)
-			tx_head[3] = 0;
-		tx_count[3]--;
-	}
+#include "profile.h"
+
+/*
+ * Every port is a pair of single-producer/single-consumer rings. Only the RX ISR
+ * moves rx_tail and only the main loop moves rx_head, the other way round for TX,
+ * so neither side masks interrupts. Sizes are powers of two up to 256: indices are
+ * bytes, wrap with a mask, and one slot stays free to tell full from empty.
+ */
+#define UART_SIZE_OK(size) ((size) >= 2 && (size) <= 256 && ((size) & ((size) - 1)) == 0)
+#if !UART_SIZE_OK(UART0_RX_BUFFER_SIZE) || !UART_SIZE_OK(UART0_TX_BUFFER_SIZE) \
+	|| !UART_SIZE_OK(UART1_RX_BUFFER_SIZE) || !UART_SIZE_OK(UART1_TX_BUFFER_SIZE) \
+	|| !UART_SIZE_OK(UART2_RX_BUFFER_SIZE) || !UART_SIZE_OK(UART2_TX_BUFFER_SIZE) \
+	|| !UART_SIZE_OK(UART3_RX_BUFFER_SIZE) || !UART_SIZE_OK(UART3_TX_BUFFER_SIZE)
+#error UART buffer sizes must be powers of two, 2 to 256.
+#endif
+
+// uartN_WriteIsr and uartN_WriteAll do not stage, they would split a sentence in progress.
+#if UART2_TX_OVERFLOW == UART_OVERFLOW_SENTENCE
+#error UART2 is written from the heading slot ISR, and cannot use UART_OVERFLOW_SENTENCE.
+#endif
+
+/** Keeps ring contents and index updates in program order. */
+#define UART_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/** UART2 is also written from the heading slot ISR (uart2_WriteIsr), so its main-context writers mask interrupts.
+ * They leave them as they were: uart2_WriteAll may be called with interrupts disabled, uart2_Write only
+ * when it does not have to wait. */
+#define UART0_TX_ENTER()
+#define UART0_TX_LEAVE()
+#define UART1_TX_ENTER()
+#define UART1_TX_LEAVE()
+#define UART2_TX_ENTER() const uint8_t uart2_interrupts_enabled = SREG & 0x80; cli()
+#define UART2_TX_LEAVE() if(uart2_interrupts_enabled) sei()
+#define UART3_TX_ENTER()
+#define UART3_TX_LEAVE()
+
+/** Called from the RX ISR with the ring index of each byte stored. */
+#define UART0_RX_HOOK(index, data) uart0_stamp_isr((index), (data))
+#define UART1_RX_HOOK(index, data)
+#define UART2_RX_HOOK(index, data)
+#define UART3_RX_HOOK(index, data) uart3_stamp_isr((index), (data))
+
+#define UART_DEFINE(n) \
+\
+static uint8_t uart##n##_rx_buffer[UART##n##_RX_BUFFER_SIZE]; \
+static uint8_t uart##n##_tx_buffer[UART##n##_TX_BUFFER_SIZE]; \
+static volatile uint8_t uart##n##_rx_head, uart##n##_rx_tail; \
+static volatile uint8_t uart##n##_tx_head, uart##n##_tx_tail; \
+static uint8_t uart##n##_tx_stage, uart##n##_tx_skip; \
+\
+/*****************************************************/ \
+static void uart##n##_init(void) \
+/*****************************************************/ \
+{ \
+	uart##n##_rx_head = uart##n##_rx_tail = 0; \
+	uart##n##_tx_head = uart##n##_tx_tail = 0; \
+	uart##n##_tx_stage = uart##n##_tx_skip = 0; \
+\
+	UBRR##n = UBRR##n##_RELOAD; \
+	UCSR##n##A = 0; \
+	UCSR##n##B = _BV(RXEN##n) | _BV(TXEN##n) | _BV(RXCIE##n); \
+	UCSR##n##C = _BV(UCSZ##n##0) | _BV(UCSZ##n##1); \
+} \
+\
+/*****************************************************/ \
+ISR(USART##n##_RX_vect) \
+/*****************************************************/ \
+{ \
+	PROFILE_ISR_BEGIN(); \
+	const uint8_t status = UCSR##n##A; \
+	const uint8_t data = UDR##n; \
+	const uint8_t tail = uart##n##_rx_tail; \
+	const uint8_t next = (tail + 1) & (UART##n##_RX_BUFFER_SIZE - 1); \
+\
+	if(status & (_BV(FE##n) | _BV(UPE##n) | _BV(DOR##n))) \
+	{ \
+		if(status & _BV(FE##n)) \
+			stats.uart[n].frame_errors++; \
+		if(status & _BV(DOR##n)) \
+			stats.uart[n].overruns++; \
+		if(status & _BV(UPE##n)) \
+			stats.uart[n].parity_errors++; \
+	} \
+	else if(next == uart##n##_rx_head) \
+	{ \
+		stats.uart[n].rx_bytes++; \
+		stats.uart[n].rx_drops++; \
+	} \
+	else \
+	{ \
+		const uint8_t used = (next - uart##n##_rx_head) & (UART##n##_RX_BUFFER_SIZE - 1); \
+		stats.uart[n].rx_bytes++; \
+		if(used > stats.uart[n].rx_peak) \
+			stats.uart[n].rx_peak = used; \
+		UART##n##_RX_HOOK(tail, data); \
+		uart##n##_rx_buffer[tail] = data; \
+		uart##n##_rx_tail = next; \
+	} \
+	PROFILE_ISR_END(PROFILE_USART##n##_RX); \
+} \
+\
+/*****************************************************/ \
+ISR(USART##n##_UDRE_vect) \
+/*****************************************************/ \
+{ \
+	PROFILE_ISR_BEGIN(); \
+	uint8_t head = uart##n##_tx_head; \
+\
+	if(head != uart##n##_tx_tail) \
+	{ \
+		UDR##n = uart##n##_tx_buffer[head]; \
+		head = (head + 1) & (UART##n##_TX_BUFFER_SIZE - 1); \
+		uart##n##_tx_head = head; \
+		stats.uart[n].tx_bytes++; \
+	} \
+	if(head == uart##n##_tx_tail) \
+		UCSR##n##B &= ~_BV(UDRIE##n); \
+	PROFILE_ISR_END(PROFILE_USART##n##_TX); \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_IsRxEmpty(void) \
+/*****************************************************/ \
+{ \
+	return uart##n##_rx_head == uart##n##_rx_tail; \
+} \
+\
+/*****************************************************/ \
+void uart##n##_FlushRX(void) \
+/*****************************************************/ \
+{ \
+	uart##n##_rx_head = uart##n##_rx_tail; \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_GetChar(void) \
+/*****************************************************/ \
+{ \
+	const uint8_t head = uart##n##_rx_head; \
+	uint8_t data; \
+\
+	while(head == uart##n##_rx_tail); \
+	UART_BARRIER(); \
+\
+	data = uart##n##_rx_buffer[head]; \
+	UART_BARRIER(); \
+	uart##n##_rx_head = (head + 1) & (UART##n##_RX_BUFFER_SIZE - 1); \
+\
+	return data; \
+} \
+\
+/*****************************************************/ \
+uint16_t uart##n##_PeekRx(const uint8_t** data) \
+/*****************************************************/ \
+{ \
+	const uint8_t head = uart##n##_rx_head; \
+	const uint8_t tail = uart##n##_rx_tail; \
+	UART_BARRIER(); \
+\
+	*data = uart##n##_rx_buffer + head; \
+	return (tail >= head ? tail : UART##n##_RX_BUFFER_SIZE) - head; \
+} \
+\
+/*****************************************************/ \
+void uart##n##_SkipRx(uint16_t count) \
+/*****************************************************/ \
+{ \
+	UART_BARRIER(); \
+	uart##n##_rx_head = (uart##n##_rx_head + count) & (UART##n##_RX_BUFFER_SIZE - 1); \
+} \
+\
+/*****************************************************/ \
+static uint16_t uart##n##_queue(const uint8_t* data, uint16_t length, uint8_t flash) \
+/*****************************************************/ \
+{ \
+	/* Takes bytes as the overflow policy says, with interrupts masked as by UART##n##_TX_ENTER. */ \
+	/* Returns the number taken, queued or dropped. Staged bytes of a sentence wait in tx_stage. */ \
+	const uint8_t head = uart##n##_tx_head; \
+	uint8_t tail = uart##n##_tx_tail; \
+	uint8_t stage = uart##n##_tx_stage; \
+	uint16_t i; \
+\
+	for(i = 0; i < length; i++) \
+	{ \
+		const uint8_t c = flash ? pgm_read_byte(data + i) : data[i]; \
+		const uint8_t next = (stage + 1) & (UART##n##_TX_BUFFER_SIZE - 1); \
+\
+		if(uart##n##_tx_skip) \
+		{ \
+			stats.uart[n].tx_drops++; \
+			uart##n##_tx_skip = c != '\n'; \
+		} \
+		else if(next != head) \
+		{ \
+			uart##n##_tx_buffer[stage] = c; \
+			stage = next; \
+			if(UART##n##_TX_OVERFLOW != UART_OVERFLOW_SENTENCE || c == '\n') \
+				tail = stage; \
+		} \
+		else if(UART##n##_TX_OVERFLOW == UART_OVERFLOW_BLOCK) \
+			break; \
+		else if(UART##n##_TX_OVERFLOW == UART_OVERFLOW_DROP) \
+			stats.uart[n].tx_drops++; \
+		else \
+		{ \
+			/* Forget the staged start of the sentence, and skip its rest. */ \
+			stats.uart[n].tx_drops += ((stage - tail) & (UART##n##_TX_BUFFER_SIZE - 1)) + 1; \
+			stage = tail; \
+			uart##n##_tx_skip = c != '\n'; \
+		} \
+	} \
+\
+	const uint8_t used = (stage - head) & (UART##n##_TX_BUFFER_SIZE - 1); \
+	if(used > stats.uart[n].tx_peak) \
+		stats.uart[n].tx_peak = used; \
+	uart##n##_tx_stage = stage; \
+	if(tail != uart##n##_tx_tail) \
+	{ \
+		UART_BARRIER(); \
+		uart##n##_tx_tail = tail; \
+		UCSR##n##B |= _BV(UDRIE##n); \
+	} \
+\
+	return i; \
+} \
+\
+/*****************************************************/ \
+void uart##n##_Write(const uint8_t* data, uint16_t length) \
+/*****************************************************/ \
+{ \
+	for(;;) \
+	{ \
+		uint16_t done; \
+\
+		UART##n##_TX_ENTER(); \
+		done = uart##n##_queue(data, length, 0); \
+		UART##n##_TX_LEAVE(); \
+\
+		if(done == length) \
+			break; \
+		data += done; \
+		length -= done; \
+	} \
+} \
+\
+/*****************************************************/ \
+void uart##n##_Write_P(PGM_P data, uint16_t length) \
+/*****************************************************/ \
+{ \
+	for(;;) \
+	{ \
+		uint16_t done; \
+\
+		UART##n##_TX_ENTER(); \
+		done = uart##n##_queue((const uint8_t*)data, length, 1); \
+		UART##n##_TX_LEAVE(); \
+\
+		if(done == length) \
+			break; \
+		data += done; \
+		length -= done; \
+	} \
+} \
+\
+/*****************************************************/ \
+void uart##n##_PutChar(uint8_t data) \
+/*****************************************************/ \
+{ \
+	uart##n##_Write(&data, 1); \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_TxRoom(void) \
+/*****************************************************/ \
+{ \
+	return (uart##n##_tx_head - uart##n##_tx_stage - 1) & (UART##n##_TX_BUFFER_SIZE - 1); \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_IsTxInSentence(void) \
+/*****************************************************/ \
+{ \
+	return uart##n##_tx_stage != uart##n##_tx_tail || uart##n##_tx_skip; \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_WriteIsr(const uint8_t* data, uint8_t length) \
+/*****************************************************/ \
+{ \
+	const uint8_t head = uart##n##_tx_head; \
+	uint8_t tail = uart##n##_tx_tail; \
+	uint8_t i; \
+\
+	if(length > ((head - tail - 1) & (UART##n##_TX_BUFFER_SIZE - 1))) \
+	{ \
+		stats.uart[n].tx_drops += length; \
+		return 0; \
+	} \
+	for(i = 0; i < length; i++) \
+	{ \
+		uart##n##_tx_buffer[tail] = data[i]; \
+		tail = (tail + 1) & (UART##n##_TX_BUFFER_SIZE - 1); \
+	} \
+	uart##n##_tx_stage = tail; \
+	uart##n##_tx_tail = tail; \
+	UCSR##n##B |= _BV(UDRIE##n); \
+	if(((tail - head) & (UART##n##_TX_BUFFER_SIZE - 1)) > stats.uart[n].tx_peak) \
+		stats.uart[n].tx_peak = (tail - head) & (UART##n##_TX_BUFFER_SIZE - 1); \
+\
+	return 1; \
+} \
+\
+/*****************************************************/ \
+uint8_t uart##n##_WriteAll(const uint8_t* data, uint8_t length) \
+/*****************************************************/ \
+{ \
+	uint8_t queued; \
+\
+	UART##n##_TX_ENTER(); \
+	queued = uart##n##_WriteIsr(data, length); \
+	UART##n##_TX_LEAVE(); \
+\
+	return queued; \
 }
 
-/*****************************************************/
-uint8_t uart0_IsRxEmpty(void)
-/*****************************************************/
-{
-	return (!rx_count[0]);	
+/** Arrival time of a UARTn_STAMP_CHAR byte. */
+typedef struct {
+	uint8_t index;		// position in uartN_rx_buffer
+	TIMESTAMP ts;
+} UART_STAMP;
+
+/** Stamps taken in the RX ISR, see UART_GETSTAMP_DEFINE. Before UART_DEFINE, for the RX hook. */
+#define UART_STAMP_DEFINE(n) \
+\
+static UART_STAMP uart##n##_stamps[UART##n##_STAMP_COUNT]; \
+static volatile uint8_t uart##n##_stamp_head, uart##n##_stamp_tail; \
+\
+/*****************************************************/ \
+static inline void uart##n##_stamp_isr(const uint8_t index, const uint8_t data) \
+/*****************************************************/ \
+{ \
+	const uint8_t next = (uart##n##_stamp_tail + 1) & (UART##n##_STAMP_COUNT - 1); \
+\
+	if(data == UART##n##_STAMP_CHAR && next != uart##n##_stamp_head) \
+	{ \
+		uart##n##_stamps[uart##n##_stamp_tail].index = index; \
+		gettimestamp_isr(uart##n##_stamps[uart##n##_stamp_tail].ts); \
+		uart##n##_stamp_tail = next; \
+	} \
 }
 
-/*****************************************************/
-uint8_t uart1_IsRxEmpty(void)
-/*****************************************************/
-{
-	return (!rx_count[1]);	
-}
+UART_STAMP_DEFINE(0)
+UART_STAMP_DEFINE(3)
 
-/*****************************************************/
-uint8_t uart2_IsRxEmpty(void)
-/*****************************************************/
-{
-	return (!rx_count[2]);	
-}
-
-/*****************************************************/
-uint8_t uart3_IsRxEmpty(void)
-/*****************************************************/
-{
-	return (!rx_count[3]);	
-}
+UART_DEFINE(0)
+UART_DEFINE(1)
+UART_DEFINE(2)
+UART_DEFINE(3)
 
 /*****************************************************/
-void uart0_FlushRX(void)
-/*****************************************************/
-{	
-	cli();
-
-	rx_head[0] = rx_tail[0] = 0;
-	rx_count[0] = 0;
-
-	sei();
-}
-
-/*****************************************************/
-void uart1_FlushRX(void)
-/*****************************************************/
-{	
-	cli();
-
-	rx_head[1] = rx_tail[1] = 0;
-	rx_count[1] = 0;
-
-	sei();
-}
-
-/*****************************************************/
-void uart2_FlushRX(void)
-/*****************************************************/
-{	
-	cli();
-
-	rx_head[2] = rx_tail[2] = 0;
-	rx_count[2] = 0;
-
-	sei();
-}
-
-/*****************************************************/
-void uart3_FlushRX(void)
-/*****************************************************/
-{	
-	cli();
-
-	rx_head[3] = rx_tail[3] = 0;
-	rx_count[3] = 0;
-
-	sei();
-}
-
-
-/*****************************************************/
-uint8_t uart0_GetChar(void)
-/*****************************************************/
-{
-	uint8_t data;
-
-	while(!rx_count[0]);
-
-	cli();
-
-	data = uart0_rx_buffer[rx_head[0]++];
-	if(rx_head[0] >= UART0_RX_BUFFER_SIZE)
-		rx_head[0] = 0;
-	rx_count[0]--;
-
-	sei();
-
-	return data;
-}
-
-/*****************************************************/
-uint8_t uart1_GetChar(void)
-/*****************************************************/
-{
-	uint8_t data;
-
-	while(!rx_count[1]);
-
-	cli();
-
-	data = uart1_rx_buffer[rx_head[1]++];
-	if(rx_head[1] >= UART1_RX_BUFFER_SIZE)
-		rx_head[1] = 0;
-	rx_count[1]--;
-
-	sei();
-
-	return data;
-}
-
-/*****************************************************/
-uint8_t uart2_GetChar(void)
-/*****************************************************/
-{
-	uint8_t data;
-
-	while(!rx_count[2]);
-
-	cli();
-
-	data = uart2_rx_buffer[rx_head[2]++];
-	if(rx_head[2] >= UART2_RX_BUFFER_SIZE)
-		rx_head[2] = 0;
-	rx_count[2]--;
-
-	sei();
-
-	return data;
-}
-
-/*****************************************************/
-uint8_t uart3_GetChar(void)
-/*****************************************************/
-{
-	uint8_t data;
-
-	while(!rx_count[3]);
-
-	cli();
-
-	data = uart3_rx_buffer[rx_head[3]++];
-	if(rx_head[3] >= UART3_RX_BUFFER_SIZE)
-		rx_head[3] = 0;
-	rx_count[3]--;
-
-	sei();
-
-	return data;
-}
-
-/*****************************************************/
-void uart0_PutChar(uint8_t data)
-/*****************************************************/
-{
-	while(tx_count[0] >= UART0_TX_BUFFER_SIZE);
-
-	cli();
-	
-	if(tx_count[0] || (!(UCSR0A & _BV(UDRE0))))
-	{
-		uart0_tx_buffer[tx_tail[0]++] = data;
-		if(tx_tail[0] >= UART0_TX_BUFFER_SIZE)
-			tx_tail[0] = 0;
-		tx_count[0]++;
-	}
-	else
-		UDR0 = data;
-
-	sei();
-}
-
-/*****************************************************/
-void uart1_PutChar(uint8_t data)
+void uart_Init(void)
 /*****************************************************/
 {
-	while(tx_count[1] >= UART1_TX_BUFFER_SIZE);
+	uart0_stamp_head = uart0_stamp_tail = 0;
+	uart3_stamp_head = uart3_stamp_tail = 0;
 
-	cli();
-	
-	if(tx_count[1] || (!(UCSR1A & _BV(UDRE1))))
-	{
-		uart1_tx_buffer[tx_tail[1]++] = data;
-		if(tx_tail[1] >= UART1_TX_BUFFER_SIZE)
-			tx_tail[1] = 0;
-		tx_count[1]++;
-	}
-	else
-		UDR1 = data;
-
-	sei();
+	uart0_init();
+	uart1_init();
+	uart2_init();
+	uart3_init();
 }
 
-/*****************************************************/
-void uart2_PutChar(uint8_t data)
-/*****************************************************/
-{
-	while(tx_count[2] >= UART2_TX_BUFFER_SIZE);
-
-	cli();
-	
-	if(tx_count[2] || (!(UCSR2A & _BV(UDRE2))))
-	{
-		uart2_tx_buffer[tx_tail[2]++] = data;
-		if(tx_tail[2] >= UART2_TX_BUFFER_SIZE)
-			tx_tail[2] = 0;
-		tx_count[2]++;
-	}
-	else
-		UDR2 = data;
-
-	sei();
+/** uartN_GetStamp, after UART_DEFINE for the RX ring. */
+#define UART_GETSTAMP_DEFINE(n) \
+\
+/*****************************************************/ \
+uint8_t uart##n##_GetStamp(const uint8_t* position, TIMESTAMP* ts) \
+/*****************************************************/ \
+{ \
+	/* Every stamp before stamp_tail has its byte before rx_tail, when read in this order. */ \
+	const uint8_t last = uart##n##_stamp_tail; \
+	const uint8_t head = uart##n##_rx_head; \
+	const uint8_t count = (uart##n##_rx_tail - head) & (UART##n##_RX_BUFFER_SIZE - 1); \
+	const uint8_t position_distance = (position - uart##n##_rx_buffer - head) & (UART##n##_RX_BUFFER_SIZE - 1); \
+	uint8_t found = 0; \
+\
+	UART_BARRIER(); \
+\
+	while(uart##n##_stamp_head != last) \
+	{ \
+		const UART_STAMP* stamp = &uart##n##_stamps[uart##n##_stamp_head]; \
+		const uint8_t distance = (stamp->index - head) & (UART##n##_RX_BUFFER_SIZE - 1); \
+\
+		/* Stamp of a later byte, still unread? */ \
+		if(distance > position_distance && distance < count) \
+			break; \
+\
+		/* Either ours or stale. */ \
+		if(distance == position_distance) \
+		{ \
+			*ts = stamp->ts; \
+			found = 1; \
+		} \
+		UART_BARRIER(); \
+		uart##n##_stamp_head = (uart##n##_stamp_head + 1) & (UART##n##_STAMP_COUNT - 1); \
+		if(found) \
+			break; \
+	} \
+\
+	return found; \
 }
 
-/*****************************************************/
-void uart3_PutChar(uint8_t data)
-/*****************************************************/
-{
-	while(tx_count[3] >= UART3_TX_BUFFER_SIZE);
-
-	cli();
-	
-	if(tx_count[3] || (!(UCSR3A & _BV(UDRE3))))
-	{
-		uart3_tx_buffer[tx_tail[3]++] = data;
-		if(tx_tail[3] >= UART3_TX_BUFFER_SIZE)
-			tx_tail[3] = 0;
-		tx_count[3]++;
-	}
-	else
-		UDR3 = data;
-
-	sei();
-}
+UART_GETSTAMP_DEFINE(0)
+UART_GETSTAMP_DEFINE(3)
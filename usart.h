@@ -2,22 +2,73 @@
 #define _USART_H
 
 #include <stdint.h>	// uint8_t
+#include <avr/pgmspace.h>	// PGM_P
+#include "main.h"	// TIMESTAMP
 
+/** What uartN_Write does when the TX ring is full, set per port with UARTn_TX_OVERFLOW. */
+#define UART_OVERFLOW_BLOCK 0		///< wait for room
+#define UART_OVERFLOW_DROP 1		///< drop the bytes that do not fit
+#define UART_OVERFLOW_SENTENCE 2	///< queue every sentence, up to its '\n', whole or not at all
+
+/** Ring sizes are powers of two, 2 to 256, set per port and direction. One byte of each stays unused. */
 #define UART0_BAUD_RATE 38400ul
+#ifndef UART0_RX_BUFFER_SIZE
 #define UART0_RX_BUFFER_SIZE 256
+#endif
+#ifndef UART0_TX_BUFFER_SIZE
 #define UART0_TX_BUFFER_SIZE 256
+#endif
+/** GPS echo. */
+#ifndef UART0_TX_OVERFLOW
+#define UART0_TX_OVERFLOW UART_OVERFLOW_SENTENCE
+#endif
+/** Arrival of this byte is timestamped in the RX interrupt, see uart0_GetStamp. */
+#define UART0_STAMP_CHAR '$'
+/** Number of pending timestamps, power of two. */
+#define UART0_STAMP_COUNT 8
 
 #define UART1_BAUD_RATE 38400ul
-#define UART1_RX_BUFFER_SIZE 256
+/** Nothing is expected on UART1.RX, it is read and discarded. */
+#ifndef UART1_RX_BUFFER_SIZE
+#define UART1_RX_BUFFER_SIZE 16
+#endif
+#ifndef UART1_TX_BUFFER_SIZE
 #define UART1_TX_BUFFER_SIZE 256
+#endif
+/** GPS and HDG output. */
+#ifndef UART1_TX_OVERFLOW
+#define UART1_TX_OVERFLOW UART_OVERFLOW_SENTENCE
+#endif
 
 #define UART2_BAUD_RATE 9600ul
-#define UART2_RX_BUFFER_SIZE 256
+/** Typed console commands. */
+#ifndef UART2_RX_BUFFER_SIZE
+#define UART2_RX_BUFFER_SIZE 32
+#endif
+#ifndef UART2_TX_BUFFER_SIZE
 #define UART2_TX_BUFFER_SIZE 256
+#endif
+/** Setup console, listings come out whole. */
+#ifndef UART2_TX_OVERFLOW
+#define UART2_TX_OVERFLOW UART_OVERFLOW_BLOCK
+#endif
 
 #define UART3_BAUD_RATE 38400ul
-#define UART3_RX_BUFFER_SIZE 128
-#define UART3_TX_BUFFER_SIZE 128
+/** Secondary GPS, same traffic as UART0.RX. */
+#ifndef UART3_RX_BUFFER_SIZE
+#define UART3_RX_BUFFER_SIZE 256
+#endif
+/** Nothing is sent on UART3.TX. */
+#ifndef UART3_TX_BUFFER_SIZE
+#define UART3_TX_BUFFER_SIZE 16
+#endif
+#ifndef UART3_TX_OVERFLOW
+#define UART3_TX_OVERFLOW UART_OVERFLOW_DROP
+#endif
+/** Arrival of this byte is timestamped in the RX interrupt, see uart3_GetStamp. */
+#define UART3_STAMP_CHAR '$'
+/** Number of pending timestamps, power of two. */
+#define UART3_STAMP_COUNT 8
 
 
 // NB! All work fine without X2.
@@ -27,22 +78,42 @@
 #define UBRR3_RELOAD ((F_CPU / (UART3_BAUD_RATE  * 16)) - 1)
 
 void uart_Init(void);
-uint8_t uart0_IsRxEmpty(void);
-uint8_t uart1_IsRxEmpty(void);
-uint8_t uart2_IsRxEmpty(void);
-uint8_t uart3_IsRxEmpty(void);
-void uart0_FlushRX(void);
-void uart1_FlushRX(void);
-void uart2_FlushRX(void);
-void uart3_FlushRX(void);
-uint8_t uart0_GetChar(void);
-uint8_t uart1_GetChar(void);
-uint8_t uart2_GetChar(void);
-uint8_t uart3_GetChar(void);
-void uart0_PutChar(uint8_t data);
-void uart1_PutChar(uint8_t data);
-void uart2_PutChar(uint8_t data);
-void uart3_PutChar(uint8_t data);
+
+/*
+ * Per port n:
+ *	uartN_IsRxEmpty, uartN_FlushRX, uartN_GetChar (waits for a byte).
+ *	uartN_PeekRx: contiguous run of received bytes, without removing them. Returns the number of bytes at *data.
+ *	uartN_SkipRx: remove count bytes previously returned by uartN_PeekRx.
+ *	uartN_Write: queue length bytes, handling a full ring as UARTn_TX_OVERFLOW says.
+ *	uartN_Write_P: same as uartN_Write, from flash.
+ *	uartN_PutChar: same as uartN_Write, one byte.
+ *	uartN_TxRoom: bytes uartN_Write takes now without waiting or dropping.
+ *	uartN_IsTxInSentence: part of a sentence written, and not yet its '\n'. Only with UART_OVERFLOW_SENTENCE.
+ *	uartN_WriteAll: queue all length bytes or none, never waiting. Returns 0 when they do not fit.
+ *	uartN_WriteIsr: same as uartN_WriteAll, for ISRs. Interrupts must be disabled.
+ */
+#define UART_DECLARE(n) \
+uint8_t uart##n##_IsRxEmpty(void); \
+void uart##n##_FlushRX(void); \
+uint8_t uart##n##_GetChar(void); \
+uint16_t uart##n##_PeekRx(const uint8_t** data); \
+void uart##n##_SkipRx(uint16_t count); \
+void uart##n##_Write(const uint8_t* data, uint16_t length); \
+void uart##n##_Write_P(PGM_P data, uint16_t length); \
+void uart##n##_PutChar(uint8_t data); \
+uint8_t uart##n##_TxRoom(void); \
+uint8_t uart##n##_IsTxInSentence(void); \
+uint8_t uart##n##_WriteAll(const uint8_t* data, uint8_t length); \
+uint8_t uart##n##_WriteIsr(const uint8_t* data, uint8_t length);
+
+UART_DECLARE(0)
+UART_DECLARE(1)
+UART_DECLARE(2)
+UART_DECLARE(3)
+
+/** Arrival time of the UARTn_STAMP_CHAR at position (as returned by uartN_PeekRx). Returns 0 when not stamped. */
+uint8_t uart0_GetStamp(const uint8_t* position, TIMESTAMP* ts);
+uint8_t uart3_GetStamp(const uint8_t* position, TIMESTAMP* ts);
 
 
 